@@ -0,0 +1,519 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../leptjson.h"
+
+#ifndef LEPT_BENCH_DATA
+#define LEPT_BENCH_DATA "bench/data"
+#endif
+
+#define BENCH_MAX_LOOKUPS 100000
+#define BENCH_MAX_TABLES  10000
+#define BENCH_RETAIN      (16u << 20)
+
+/*
+ * Output is CSV, one row per (corpus, op), preceded by '#' comment lines:
+ *   corpus,op,bytes,items,reps,min_ns,median_ns,ns_per_op,mb_per_s
+ * min_ns/median_ns are for one pass over the whole corpus, ns_per_op divides
+ * the median by items (documents, or lookups for "find" and "column*"), and
+ * mb_per_s is bytes over the median (lookups read no input, so they report
+ * 0 bytes).
+ */
+
+typedef struct {
+    const lept_value *o;
+    const char *k;
+    size_t klen;
+} bench_lookup;
+
+typedef struct {
+    const char *name;
+    char *text, *stream;  /* stream: the unsplit text */
+    char **docs;
+    size_t count, bytes;
+    lept_value *values, *copies, *scratch, *lazy;
+    bench_lookup *lookups;
+    size_t lookup_count;
+    const lept_value **tables;  /* arrays starting with an object */
+    size_t table_count, column_lookups;
+    lept_parser *parser;
+    lept_serializer *serializer;
+    lept_reclaimer *reclaimer;
+    lept_serializer **incremental;  /* one per document */
+    char **edits;                   /* pointer to the last child of each root */
+    char *out;                      /* fits the output of any document */
+    size_t out_size;
+} bench_corpus;
+
+static const char *corpus_files[] = {
+    "twitter.json", "canada.json", "nested.json", "strings.json", "events.ndjson"
+};
+
+static volatile size_t sink;
+
+static const lept_parse_options lazy_options = { LEPT_PARSE_LAZY_NUMBERS, NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+static const lept_parse_options packed_options = { LEPT_PARSE_PACK_NUMBERS, NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+static const lept_parse_options stream_options = { LEPT_PARSE_STREAM_END, NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+
+static double now_ns(void) {
+#if defined(_WIN32)
+    return clock() * (1e9 / CLOCKS_PER_SEC);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+#endif
+}
+
+static char *read_file(const char *path, size_t *length) {
+    FILE *fp = fopen(path, "rb");
+    char *text;
+    long size;
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = (char *)malloc((size_t)size + 1);
+    *length = fread(text, 1, (size_t)size, fp);
+    text[*length] = '\0';
+    fclose(fp);
+    return text;
+}
+
+/* a JSON Pointer to the last member or element of v, "" if it has none */
+static char *last_child_pointer(const lept_value *v) {
+    char *p, *w;
+    const char *k = "";
+    size_t klen = 0, i;
+    char index[24];
+    if (lept_get_type(v) == LEPT_ARRAY && lept_get_array_size(v) > 0) {
+        klen = (size_t)sprintf(index, "%zu", lept_get_array_size(v) - 1);
+        k = index;
+    } else if (lept_get_type(v) == LEPT_OBJECT && lept_get_object_size(v) > 0) {
+        k = lept_get_object_key(v, lept_get_object_size(v) - 1);
+        klen = lept_get_object_key_length(v, lept_get_object_size(v) - 1);
+    } else {
+        return (char *)calloc(1, 1);
+    }
+    w = p = (char *)malloc(klen * 2 + 2);
+    *w++ = '/';
+    for (i = 0; i < klen; ++i) {
+        if (k[i] == '~' || k[i] == '/') {
+            *w++ = '~';
+            *w++ = k[i] == '~' ? '0' : '1';
+        } else {
+            *w++ = k[i];
+        }
+    }
+    *w = '\0';
+    return p;
+}
+
+/* NDJSON is split into one document per non-empty line */
+static void split_docs(bench_corpus *b, int ndjson) {
+    char *p = b->text, *nl;
+    b->docs = (char **)malloc(sizeof(char *) * (ndjson ? b->bytes / 2 + 1 : 1));
+    b->count = 0;
+    if (!ndjson) {
+        b->docs[b->count++] = b->text;
+        return;
+    }
+    while (*p != '\0') {
+        if ((nl = strchr(p, '\n')) != NULL)
+            *nl = '\0';
+        if (*p != '\0')
+            b->docs[b->count++] = p;
+        if (nl == NULL)
+            break;
+        p = nl + 1;
+    }
+}
+
+static void collect_lookups(bench_corpus *b, const lept_value *v) {
+    size_t i;
+    switch (lept_get_type(v)) {
+        case LEPT_ARRAY:
+            if (lept_get_array_size(v) > 0 &&
+                lept_get_type(lept_get_array_element(v, 0)) == LEPT_OBJECT &&
+                b->table_count < BENCH_MAX_TABLES) {
+                b->tables[b->table_count++] = v;
+                b->column_lookups += lept_get_array_size(v) *
+                                     lept_get_object_size(lept_get_array_element(v, 0));
+            }
+            for (i = 0; i < lept_get_array_size(v); ++i)
+                collect_lookups(b, lept_get_array_element(v, i));
+            break;
+        case LEPT_OBJECT:
+            for (i = 0; i < lept_get_object_size(v); ++i) {
+                if (b->lookup_count < BENCH_MAX_LOOKUPS) {
+                    bench_lookup *l = &b->lookups[b->lookup_count++];
+                    l->o = v;
+                    l->k = lept_get_object_key(v, i);
+                    l->klen = lept_get_object_key_length(v, i);
+                }
+                collect_lookups(b, lept_get_object_value(v, i));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int load_corpus(bench_corpus *b, const char *dir, const char *file) {
+    char path[1024];
+    size_t i, n = strlen(file);
+    int ndjson = n > 7 && strcmp(file + n - 7, ".ndjson") == 0;
+    memset(b, 0, sizeof(*b));
+    b->name = file;
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if ((b->text = read_file(path, &b->bytes)) == NULL) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 0;
+    }
+    b->stream = (char *)malloc(b->bytes + 1);
+    memcpy(b->stream, b->text, b->bytes + 1);
+    split_docs(b, ndjson);
+    b->values = (lept_value *)malloc(sizeof(lept_value) * b->count);
+    b->copies = (lept_value *)malloc(sizeof(lept_value) * b->count);
+    b->scratch = (lept_value *)malloc(sizeof(lept_value) * b->count);
+    b->lazy = (lept_value *)malloc(sizeof(lept_value) * b->count);
+    b->incremental = (lept_serializer **)calloc(b->count, sizeof(lept_serializer *));
+    b->edits = (char **)calloc(b->count, sizeof(char *));
+    b->lookups = (bench_lookup *)malloc(sizeof(bench_lookup) * BENCH_MAX_LOOKUPS);
+    b->tables = (const lept_value **)malloc(sizeof(lept_value *) * BENCH_MAX_TABLES);
+    b->parser = lept_parser_create(NULL, BENCH_RETAIN);
+    b->serializer = lept_serializer_create(NULL, BENCH_RETAIN);
+    b->reclaimer = lept_reclaimer_create(NULL);
+    for (i = 0; i < b->count; ++i) {
+        lept_init(&b->values[i]);
+        lept_init(&b->copies[i]);
+        lept_init(&b->scratch[i]);
+        lept_init(&b->lazy[i]);
+    }
+    for (i = 0; i < b->count; ++i) {
+        int ret;
+        if ((ret = lept_parse(&b->values[i], b->docs[i])) != LEPT_PARSE_OK) {
+            fprintf(stderr, "%s: document %zu fails to parse (%d)\n", path, i, ret);
+            return 0;
+        }
+        lept_copy(&b->copies[i], &b->values[i]);
+        lept_parse_ex(&b->lazy[i], b->docs[i], &lazy_options);
+        collect_lookups(b, &b->values[i]);
+        b->incremental[i] = lept_serializer_create(NULL, BENCH_RETAIN);
+        lept_serializer_set_incremental(b->incremental[i], 1);
+        b->edits[i] = last_child_pointer(&b->values[i]);
+        if (lept_stringify_length(&b->values[i]) >= b->out_size)
+            b->out_size = lept_stringify_length(&b->values[i]) + 1;
+    }
+    b->out = (char *)malloc(b->out_size);
+    return 1;
+}
+
+static void free_corpus(bench_corpus *b) {
+    size_t i;
+    for (i = 0; i < b->count; ++i) {
+        lept_free(&b->values[i]);
+        lept_free(&b->copies[i]);
+        lept_free(&b->scratch[i]);
+        lept_free(&b->lazy[i]);
+        if (b->incremental != NULL) {
+            lept_serializer_destroy(b->incremental[i]);
+            free(b->edits[i]);
+        }
+    }
+    free(b->values);
+    free(b->copies);
+    free(b->scratch);
+    free(b->lazy);
+    free(b->incremental);
+    free(b->edits);
+    free(b->out);
+    free(b->lookups);
+    free((void *)b->tables);
+    lept_parser_destroy(b->parser);
+    lept_serializer_destroy(b->serializer);
+    lept_reclaimer_destroy(b->reclaimer);
+    free(b->docs);
+    free(b->text);
+    free(b->stream);
+}
+
+static void op_none(bench_corpus *b) {
+    (void)b;
+}
+
+static void op_parse(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_parse(&b->scratch[i], b->docs[i]);
+}
+
+static void op_parse_reused(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_parser_parse(b->parser, &b->scratch[i], b->docs[i], NULL);
+}
+
+static void op_parse_lazy(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_parse_ex(&b->scratch[i], b->docs[i], &lazy_options);
+}
+
+static void op_parse_packed(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_parse_ex(&b->scratch[i], b->docs[i], &packed_options);
+}
+
+/* the same documents, taken one by one out of the unsplit text */
+static void op_parse_stream(bench_corpus *b) {
+    size_t offset = 0;
+    for (size_t i = 0; i < b->count; ++i)
+        lept_parser_next(b->parser, &b->scratch[i], b->stream, b->bytes, &offset, &stream_options);
+}
+
+static void op_free(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_free(&b->scratch[i]);
+}
+
+/* what the caller pays to drop the documents, then what is left for idle time */
+static void op_defer(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_reclaimer_defer(b->reclaimer, &b->scratch[i], 0);
+}
+
+static void op_flush(bench_corpus *b) {
+    lept_reclaimer_flush(b->reclaimer);
+}
+
+static void op_parse_defer(bench_corpus *b) {
+    op_parse(b);
+    op_defer(b);
+}
+
+static void op_stringify(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i) {
+        char *json;
+        size_t length;
+        lept_stringify(&b->values[i], &json, &length);
+        sink += length;
+        free(json);
+    }
+}
+
+static void op_stringify_buffer(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i) {
+        size_t length;
+        lept_stringify_buffer(&b->values[i], b->out, b->out_size, &length, NULL);
+        sink += length;
+    }
+}
+
+static void op_stringify_length(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        sink += lept_stringify_length(&b->values[i]);
+}
+
+static void op_stringify_scratch(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i) {
+        char *json;
+        size_t length;
+        lept_stringify(&b->scratch[i], &json, &length);
+        sink += length;
+        free(json);
+    }
+}
+
+static void op_stringify_lazy(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i) {
+        char *json;
+        size_t length;
+        lept_stringify(&b->lazy[i], &json, &length);
+        sink += length;
+        free(json);
+    }
+}
+
+static void op_stringify_reused(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i) {
+        const char *json;
+        size_t length;
+        lept_serializer_write(b->serializer, &b->values[i], &json, &length, NULL);
+        sink += length;
+    }
+}
+
+/* writes again after touching one member near the root */
+static void op_stringify_incremental(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i) {
+        const char *json;
+        size_t length;
+        lept_serializer_touch(b->incremental[i], &b->values[i], b->edits[i]);
+        lept_serializer_write(b->incremental[i], &b->values[i], &json, &length, NULL);
+        sink += length;
+    }
+}
+
+static void op_equal(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        sink += lept_is_equal(&b->values[i], &b->copies[i]);
+}
+
+static void op_hash_clear(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        lept_hash_clear(&b->values[i]);
+}
+
+static void op_hash(bench_corpus *b) {
+    for (size_t i = 0; i < b->count; ++i)
+        sink += lept_hash(&b->values[i]);
+}
+
+static void op_find(bench_corpus *b) {
+    for (size_t i = 0; i < b->lookup_count; ++i) {
+        const bench_lookup *l = &b->lookups[i];
+        sink += lept_find_object_value((lept_value *)l->o, l->k, l->klen) != NULL;
+    }
+}
+
+/* every key of the first record of a table looked up in all its records */
+static void bench_columns(bench_corpus *b, int hinted) {
+    for (size_t t = 0; t < b->table_count; ++t) {
+        const lept_value *a = b->tables[t], *first = lept_get_array_element(a, 0);
+        for (size_t k = 0; k < lept_get_object_size(first); ++k) {
+            const char *key = lept_get_object_key(first, k);
+            size_t klen = lept_get_object_key_length(first, k), hint = 0;
+            for (size_t i = 0; i < lept_get_array_size(a); ++i) {
+                const lept_value *o = lept_get_array_element(a, i);
+                if (lept_get_type(o) != LEPT_OBJECT)
+                    continue;
+                sink += hinted ? lept_find_object_index_hint(o, key, klen, &hint)
+                               : lept_find_object_index(o, key, klen);
+            }
+        }
+    }
+}
+
+static void op_column(bench_corpus *b) {
+    bench_columns(b, 0);
+}
+
+static void op_column_hint(bench_corpus *b) {
+    bench_columns(b, 1);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* setup and teardown run around every repetition but are not timed */
+static void bench_run(bench_corpus *b, const char *op, size_t bytes, size_t items,
+                      void (*setup)(bench_corpus *), void (*run)(bench_corpus *),
+                      void (*teardown)(bench_corpus *), int warmup, int reps) {
+    double *t = (double *)malloc(sizeof(double) * reps), median;
+    int i;
+    for (i = 0; i < warmup; ++i) {
+        setup(b);
+        run(b);
+        teardown(b);
+    }
+    for (i = 0; i < reps; ++i) {
+        double start;
+        setup(b);
+        start = now_ns();
+        run(b);
+        t[i] = now_ns() - start;
+        teardown(b);
+    }
+    qsort(t, reps, sizeof(double), compare_double);
+    median = reps % 2 ? t[reps / 2] : (t[reps / 2 - 1] + t[reps / 2]) / 2;
+    printf("%s,%s,%zu,%zu,%d,%.0f,%.0f,%.1f,%.2f\n", b->name, op, bytes, items, reps,
+           t[0], median, items ? median / items : 0.0, median > 0 ? bytes * 1e3 / median : 0.0);
+    fflush(stdout);
+    free(t);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-w warmup] [-r reps] [-d datadir] [corpus...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = LEPT_BENCH_DATA;
+    const char **files = corpus_files;
+    int nfiles = sizeof(corpus_files) / sizeof(corpus_files[0]);
+    int warmup = 3, reps = 10, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc)
+            usage(argv[0]);
+        if (strcmp(argv[i], "-w") == 0)
+            warmup = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0)
+            reps = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-d") == 0)
+            dir = argv[i + 1];
+        else
+            usage(argv[0]);
+    }
+    if (warmup < 0 || reps < 1)
+        usage(argv[0]);
+    if (i < argc) {
+        files = (const char **)(argv + i);
+        nfiles = argc - i;
+    }
+
+#if defined(__OPTIMIZE__) || !defined(__GNUC__)
+    printf("# leptjson_bench warmup=%d reps=%d\n", warmup, reps);
+#else
+    printf("# leptjson_bench warmup=%d reps=%d (unoptimized build)\n", warmup, reps);
+#endif
+    printf("corpus,op,bytes,items,reps,min_ns,median_ns,ns_per_op,mb_per_s\n");
+    for (i = 0; i < nfiles; ++i) {
+        bench_corpus b;
+        if (!load_corpus(&b, dir, files[i])) {
+            free_corpus(&b);
+            return 1;
+        }
+        bench_run(&b, "parse", b.bytes, b.count, op_none, op_parse, op_free, warmup, reps);
+        bench_run(&b, "parse_reused", b.bytes, b.count, op_none, op_parse_reused, op_free,
+                  warmup, reps);
+        bench_run(&b, "parse_stream", b.bytes, b.count, op_none, op_parse_stream, op_free,
+                  warmup, reps);
+        bench_run(&b, "parse_lazy", b.bytes, b.count, op_none, op_parse_lazy, op_free, warmup,
+                  reps);
+        bench_run(&b, "parse_packed", b.bytes, b.count, op_none, op_parse_packed, op_free,
+                  warmup, reps);
+        bench_run(&b, "stringify_packed", b.bytes, b.count, op_parse_packed, op_stringify_scratch,
+                  op_free, warmup, reps);
+        bench_run(&b, "stringify", b.bytes, b.count, op_none, op_stringify, op_none, warmup, reps);
+        bench_run(&b, "stringify_buffer", b.bytes, b.count, op_none, op_stringify_buffer,
+                  op_none, warmup, reps);
+        bench_run(&b, "stringify_length", b.bytes, b.count, op_none, op_stringify_length,
+                  op_none, warmup, reps);
+        bench_run(&b, "stringify_lazy", b.bytes, b.count, op_none, op_stringify_lazy, op_none,
+                  warmup, reps);
+        bench_run(&b, "stringify_reused", b.bytes, b.count, op_none, op_stringify_reused, op_none,
+                  warmup, reps);
+        bench_run(&b, "stringify_incremental", b.bytes, b.count, op_none,
+                  op_stringify_incremental, op_none, warmup, reps);
+        bench_run(&b, "is_equal", b.bytes, b.count, op_none, op_equal, op_none, warmup, reps);
+        bench_run(&b, "hash", b.bytes, b.count, op_hash_clear, op_hash, op_hash_clear, warmup,
+                  reps);
+        bench_run(&b, "find", 0, b.lookup_count, op_none, op_find, op_none, warmup, reps);
+        bench_run(&b, "column", 0, b.column_lookups, op_none, op_column, op_none, warmup, reps);
+        bench_run(&b, "column_hint", 0, b.column_lookups, op_none, op_column_hint, op_none,
+                  warmup, reps);
+        bench_run(&b, "free", b.bytes, b.count, op_parse, op_free, op_none, warmup, reps);
+        bench_run(&b, "free_defer", b.bytes, b.count, op_parse, op_defer, op_flush, warmup, reps);
+        bench_run(&b, "free_drain", b.bytes, b.count, op_parse_defer, op_flush, op_none, warmup,
+                  reps);
+        free_corpus(&b);
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../leptjson.hpp"
+
+#ifndef LEPT_BENCH_DATA
+#define LEPT_BENCH_DATA "bench/data"
+#endif
+
+/*
+ * Each op of leptjson.hpp next to the C API calls it stands for, on the
+ * corpora of bench.c and in its CSV format:
+ *   corpus,op,bytes,items,reps,min_ns,median_ns,ns_per_op,mb_per_s
+ * "walk" visits every value, summing string and key lengths and numbers.
+ */
+
+static const char *corpus_files[] = {
+    "twitter.json", "canada.json", "nested.json", "strings.json", "events.ndjson"
+};
+
+static volatile double sink;
+
+struct bench_corpus {
+    const char *name;
+    std::vector<std::string> docs;
+    std::vector<lept::Document> values;
+    size_t bytes;
+};
+
+static double now_ns() {
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* NDJSON is split into one document per non-empty line */
+static bool load_corpus(bench_corpus &b, const char *dir, const char *file) {
+    std::string path = std::string(dir) + "/" + file, text, line;
+    size_t n = strlen(file);
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream ss;
+    b.name = file;
+    if (!in) {
+        fprintf(stderr, "cannot read %s\n", path.c_str());
+        return false;
+    }
+    ss << in.rdbuf();
+    text = ss.str();
+    b.bytes = text.size();
+    if (n > 7 && strcmp(file + n - 7, ".ndjson") == 0) {
+        std::istringstream lines(text);
+        while (std::getline(lines, line))
+            if (!line.empty())
+                b.docs.push_back(line);
+    } else {
+        b.docs.push_back(text);
+    }
+    for (const std::string &doc : b.docs) {
+        b.values.emplace_back(doc);
+        if (!b.values.back().ok()) {
+            fprintf(stderr, "%s: document %zu fails to parse\n", path.c_str(), b.docs.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+static double walk_c(const lept_value *v) {
+    double sum = 0;
+    size_t i;
+    switch (lept_get_type(v)) {
+        case LEPT_STRING:
+            return (double)lept_get_string_length(v);
+        case LEPT_NUMBER:
+            return lept_get_number(v);
+        case LEPT_ARRAY:
+            for (i = 0; i < lept_get_array_size(v); ++i)
+                sum += walk_c(lept_get_array_element(v, i));
+            return sum;
+        case LEPT_OBJECT:
+            for (i = 0; i < lept_get_object_size(v); ++i)
+                sum += lept_get_object_key_length(v, i) + walk_c(lept_get_object_value(v, i));
+            return sum;
+        default:
+            return 1;
+    }
+}
+
+static double walk_cpp(lept::Ref v) {
+    double sum = 0;
+    switch (v.type()) {
+        case LEPT_STRING:
+            return (double)v.string().size();
+        case LEPT_NUMBER:
+            return v.number();
+        case LEPT_ARRAY:
+            for (lept::Ref e : v.elements())
+                sum += walk_cpp(e);
+            return sum;
+        case LEPT_OBJECT:
+            for (auto [key, value] : v.members())
+                sum += key.size() + walk_cpp(value);
+            return sum;
+        default:
+            return 1;
+    }
+}
+
+static void op_parse(bench_corpus &b) {
+    for (const std::string &doc : b.docs) {
+        lept_value v;
+        lept_init(&v);
+        lept_parse(&v, doc.c_str());
+        sink = sink + lept_get_type(&v);
+        lept_free(&v);
+    }
+}
+
+static void op_parse_cpp(bench_corpus &b) {
+    for (const std::string &doc : b.docs) {
+        lept::Document v(doc);
+        sink = sink + v.type();
+    }
+}
+
+static void op_walk(bench_corpus &b) {
+    for (lept::Document &v : b.values)
+        sink = sink + walk_c(v.get());
+}
+
+static void op_walk_cpp(bench_corpus &b) {
+    for (lept::Document &v : b.values)
+        sink = sink + walk_cpp(v);
+}
+
+static void bench_run(bench_corpus &b, const char *op, void (*run)(bench_corpus &), int warmup,
+                      int reps) {
+    std::vector<double> t(reps);
+    double median;
+    int i;
+    for (i = 0; i < warmup; ++i)
+        run(b);
+    for (i = 0; i < reps; ++i) {
+        double start = now_ns();
+        run(b);
+        t[i] = now_ns() - start;
+    }
+    std::sort(t.begin(), t.end());
+    median = reps % 2 ? t[reps / 2] : (t[reps / 2 - 1] + t[reps / 2]) / 2;
+    printf("%s,%s,%zu,%zu,%d,%.0f,%.0f,%.1f,%.2f\n", b.name, op, b.bytes, b.docs.size(), reps,
+           t[0], median, median / b.docs.size(), median > 0 ? b.bytes * 1e3 / median : 0.0);
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-w warmup] [-r reps] [-d datadir] [corpus...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = LEPT_BENCH_DATA;
+    const char **files = corpus_files;
+    int nfiles = sizeof(corpus_files) / sizeof(corpus_files[0]);
+    int warmup = 3, reps = 10, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc)
+            usage(argv[0]);
+        if (strcmp(argv[i], "-w") == 0)
+            warmup = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0)
+            reps = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-d") == 0)
+            dir = argv[i + 1];
+        else
+            usage(argv[0]);
+    }
+    if (warmup < 0 || reps < 1)
+        usage(argv[0]);
+    if (i < argc) {
+        files = (const char **)(argv + i);
+        nfiles = argc - i;
+    }
+
+    printf("# leptjson_bench_cpp warmup=%d reps=%d\n", warmup, reps);
+    printf("corpus,op,bytes,items,reps,min_ns,median_ns,ns_per_op,mb_per_s\n");
+    for (i = 0; i < nfiles; ++i) {
+        bench_corpus b;
+        if (!load_corpus(b, dir, files[i]))
+            return 1;
+        bench_run(b, "parse", op_parse, warmup, reps);
+        bench_run(b, "parse_cpp", op_parse_cpp, warmup, reps);
+        bench_run(b, "walk", op_walk, warmup, reps);
+        bench_run(b, "walk_cpp", op_walk_cpp, warmup, reps);
+    }
+    return 0;
+}
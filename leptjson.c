@@ -1,15 +1,33 @@
+/* clock_gettime for the stats; before any header, which may pull in <features.h> */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include "leptjson.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
-#include "leptjson.h"
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 #ifndef LEPT_PARSE_STACK_INIT_SIZE
 #define LEPT_PARSE_STACK_INIT_SIZE 256
 #endif
+#if LEPT_PARSE_STACK_INIT_SIZE < 4
+#error "LEPT_PARSE_STACK_INIT_SIZE must be at least 4 for the stack to grow"
+#endif
+
+#ifndef LEPT_PARSE_MAX_DEPTH
+#define LEPT_PARSE_MAX_DEPTH 1024
+#endif
 
 #define EXPECT(c, ch)      do { assert(*c->json == (ch)); c->json++; } while(0)
 #define ISDIGIT(ch)        ((ch) >= '0' && (ch) <= '9')
@@ -19,13 +37,311 @@
     do { \
         *(char *)lept_context_push(c, sizeof(char)) = (ch); \
     } while(0)
+#define PUTS(c, s, len) memcpy(lept_context_push(c, len), s, len)
+
+typedef struct lept_path_node lept_path_node;
+
+/* one segment of a projection path, siblings chained through `next` */
+struct lept_path_node {
+    const char *k;
+    size_t klen;
+    lept_path_node *child, *next;
+    int leaf;
+};
 
 typedef struct {
     const char *json;
+    const char *end;            /* only used when skipping unselected values */
+    const lept_path_node *sel;  /* NULL: materialize everything */
+    unsigned flags;
     char *stack;
     size_t size, top;
+    int borrowed;               /* stack is not ours, move to the heap to grow */
+    int grown;                  /* this parse allocated the stack: all of it is budget */
+    size_t frame;               /* offset of the innermost open container */
+    size_t depth, max_depth;
+    /* bytes taken for values so far, and the limits of lept_parse_options */
+    size_t used, max_bytes, max_string_length, max_elements;
+    lept_stats *stats;          /* NULL unless the caller asked for them */
+    const lept_allocator *alloc;        /* for the values built */
+    const lept_allocator *stack_alloc;  /* for the stack */
 } lept_context;
 
+static void *lept_std_malloc(void *user, size_t size) {
+    (void)user;
+    return malloc(size);
+}
+
+static void *lept_std_realloc(void *user, void *ptr, size_t old_size, size_t new_size) {
+    (void)user;
+    (void)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void lept_std_free(void *user, void *ptr, size_t size) {
+    (void)user;
+    (void)size;
+    free(ptr);
+}
+
+static const lept_allocator lept_std_allocator = {
+    lept_std_malloc, lept_std_realloc, lept_std_free, NULL
+};
+
+/* the default allocator is called directly */
+static void *lept_malloc(const lept_allocator *a, size_t size) {
+    return a == &lept_std_allocator ? malloc(size) : a->malloc(a->user, size);
+}
+
+static void lept_release(const lept_allocator *a, void *p, size_t size) {
+    if (a == &lept_std_allocator)
+        free(p);
+    else
+        a->free(a->user, p, size);
+}
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define LEPT_ATOMIC_LOAD(p) (*(volatile size_t *)(p))
+#define LEPT_ATOMIC_INC(p)  ((size_t)_InterlockedIncrement64((volatile __int64 *)(p)))
+#define LEPT_ATOMIC_DEC(p)  ((size_t)_InterlockedDecrement64((volatile __int64 *)(p)))
+#define LEPT_HASH_LOAD(v)     (*(volatile uint32_t *)&(v)->hash)
+#define LEPT_HASH_STORE(v, h) (*(volatile uint32_t *)&(v)->hash = (h))
+#else
+#define LEPT_ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define LEPT_ATOMIC_INC(p)  __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define LEPT_ATOMIC_DEC(p)  __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+/* hashes are cached through const pointers, maybe by several readers at once */
+#define LEPT_HASH_LOAD(v)     __atomic_load_n(&(v)->hash, __ATOMIC_RELAXED)
+#define LEPT_HASH_STORE(v, h) __atomic_store_n((uint32_t *)&(v)->hash, h, __ATOMIC_RELAXED)
+#endif
+
+/*
+ * Strings and array/object bodies from the default allocator are plain
+ * malloc blocks. Those from a caller's allocator, or belonging to a shared
+ * lept_doc, are marked on their value and start with a header naming the
+ * allocator that owns them (keys belong to their object's) and counting
+ * the values that share them, so lept_free needs no context.
+ */
+#define LEPT_VALUE_HEADER 0x1
+
+/* integers that fit are kept exactly, in u.i64 or (above INT64_MAX) u.u64 */
+#define LEPT_VALUE_INT64  0x2
+#define LEPT_VALUE_UINT64 0x4
+
+/* other numbers may point at their text (u.r.p), decoded into u.r.n on first use */
+#define LEPT_VALUE_RAW     0x8
+#define LEPT_VALUE_DECODED 0x10
+
+/* an array of numbers only, kept as int64_t[] (with LEPT_VALUE_INT64) or double[] */
+#define LEPT_VALUE_PACKED  0x20
+#define PACKED_SIZE 8
+
+/*
+ * set on the root an incremental serializer last wrote; every array and
+ * object is built with its flags cleared, so a free and re-parse drops it
+ */
+#define LEPT_VALUE_SERIALIZED 0x40
+
+typedef struct {
+    const lept_allocator *a;
+    size_t refs;
+} lept_block;
+
+#define BLOCK(p) ((lept_block *)(p) - 1)
+
+static void *lept_value_alloc(lept_value *v, const lept_allocator *a, size_t size) {
+    lept_block *b;
+    if (a == &lept_std_allocator) {
+        v->flags = 0;
+        return malloc(size);
+    }
+    v->flags = LEPT_VALUE_HEADER;
+    b = (lept_block *)a->malloc(a->user, sizeof(lept_block) + size);
+    b->a = a;
+    b->refs = 1;
+    return b + 1;
+}
+
+/* the heap block of a string or a non-empty container, NULL otherwise */
+static void *lept_value_body(const lept_value *v) {
+    switch (v->type) {
+        case LEPT_STRING: return v->u.s.s;
+        case LEPT_ARRAY:  return v->u.a.e;
+        case LEPT_OBJECT: return v->u.o.m;
+        default:          return NULL;
+    }
+}
+
+/* one more value shares the body of v */
+static void lept_value_ref(const lept_value *v) {
+    void *body = lept_value_body(v);
+    if (body != NULL) {
+        assert(v->flags & LEPT_VALUE_HEADER);
+        LEPT_ATOMIC_INC(&BLOCK(body)->refs);
+    }
+}
+
+/* drops the reference of v to its body, true if that was the last one */
+static int lept_value_unref(const lept_value *v, void *body) {
+    lept_block *b;
+    if (!(v->flags & LEPT_VALUE_HEADER))
+        return 1;
+    b = BLOCK(body);
+    return LEPT_ATOMIC_LOAD(&b->refs) == 1 || LEPT_ATOMIC_DEC(&b->refs) == 0;
+}
+
+static void lept_value_release(const lept_value *v, void *p, size_t size) {
+    if (v->flags & LEPT_VALUE_HEADER) {
+        lept_block *b = BLOCK(p);
+        b->a->free(b->a->user, b, sizeof(lept_block) + size);
+    } else {
+        free(p);
+    }
+}
+
+static const lept_allocator *lept_value_allocator(const lept_value *v) {
+    void *body = lept_value_body(v);
+    return body != NULL && (v->flags & LEPT_VALUE_HEADER) ? BLOCK(body)->a
+                                                          : &lept_std_allocator;
+}
+
+/*
+ * Keys always have a header: objects of one shape parsed in a row share
+ * theirs, and copies share them too when made with the same allocator.
+ */
+static char *lept_key_new(const lept_allocator *a, const char *s, size_t len) {
+    lept_block *b = (lept_block *)lept_malloc(a, sizeof(lept_block) + len + 1);
+    char *k = (char *)(b + 1);
+    b->a = a;
+    b->refs = 1;
+    memcpy(k, s, len);
+    k[len] = '\0';
+    return k;
+}
+
+static char *lept_key_copy(const lept_allocator *a, char *k, size_t klen) {
+    if (BLOCK(k)->a != a)
+        return lept_key_new(a, k, klen);
+    LEPT_ATOMIC_INC(&BLOCK(k)->refs);
+    return k;
+}
+
+/* the bytes given back, 0 if the key is still shared */
+static size_t lept_key_release(char *k, size_t klen) {
+    lept_block *b = BLOCK(k);
+    if (LEPT_ATOMIC_LOAD(&b->refs) == 1 || LEPT_ATOMIC_DEC(&b->refs) == 0) {
+        lept_release(b->a, b, sizeof(lept_block) + klen + 1);
+        return klen + 1;
+    }
+    return 0;
+}
+
+#if LEPT_ENABLE_STATS
+static double lept_now_ns(void) {
+#if defined(_WIN32)
+    return clock() * (1e9 / CLOCKS_PER_SEC);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+#endif
+}
+
+/* `st` names the stats inside `stmt` */
+#define STAT(c, stmt) \
+    do { \
+        lept_stats *st = (c)->stats; \
+        if (st != NULL) { stmt; } \
+    } while(0)
+#define STAT_START(c, t)        double t = (c)->stats != NULL ? lept_now_ns() : 0.0
+/* only sampled where the stack is about to shrink, keeping pushes cheap */
+#define STAT_PEAK(c)            STAT(c, if ((c)->top > st->peak_stack) st->peak_stack = (c)->top)
+#define STAT_STOP(c, field, t)  STAT(c, st->field += lept_now_ns() - (t))
+#else
+#define STAT(c, stmt)           ((void)0)
+#define STAT_START(c, t)        ((void)0)
+#define STAT_PEAK(c)            ((void)0)
+#define STAT_STOP(c, field, t)  ((void)0)
+#endif
+
+#define LEPT_FRAME_NONE ((size_t)-1)
+
+/*
+ * An open array or object: pushed on the context stack when its bracket is
+ * read, followed by its elements (lept_value) or members (lept_member).
+ */
+typedef struct {
+    size_t parent, size;
+    const lept_path_node *sel;
+    lept_type type;
+    /* the body of the container this one likely repeats, see lept_parse_shape */
+    const void *shape;
+    size_t shape_size;
+} lept_frame;
+
+/* grows the stack to hold at least need bytes, by a quarter at a time but no more than cap */
+static void lept_context_grow(lept_context *c, size_t need, size_t cap) {
+    size_t old = c->size;
+    assert(need <= cap);
+    /* a borrowed stack may be only a few bytes, which growing by a quarter never leaves */
+    if (c->size < LEPT_PARSE_STACK_INIT_SIZE)
+        c->size = LEPT_PARSE_STACK_INIT_SIZE;
+    while (need > c->size)
+        c->size += c->size >> 2;
+    if (c->size > cap)
+        c->size = cap;
+    if (c->borrowed || c->stack == NULL) {
+        char *stack = (char *)c->stack_alloc->malloc(c->stack_alloc->user, c->size);
+        if (c->top > 0)
+            memcpy(stack, c->stack, c->top);
+        c->stack = stack;
+        c->borrowed = 0;
+    } else {
+        c->stack = (char *)c->stack_alloc->realloc(c->stack_alloc->user, c->stack,
+                                                   old, c->size);
+    }
+    c->grown = 1;
+    STAT(c, ++st->grows; st->grow_bytes += c->size);
+}
+
+static void *lept_context_push(lept_context *c, size_t size) {
+    void *ret;
+    assert(size > 0);
+    if(c->top + size > c->size)
+        lept_context_grow(c, c->top + size, (size_t)-1);
+    ret = c->stack + c->top;
+    c->top += size;
+    return ret;
+}
+
+static void *lept_context_pop(lept_context *c, size_t size) {
+    assert(c->top >= size);
+    return c->stack + (c->top -= size);
+}
+
+static void lept_context_free(lept_context *c) {
+    if (!c->borrowed && c->stack != NULL)
+        c->stack_alloc->free(c->stack_alloc->user, c->stack, c->size);
+}
+
+/* a context used only as a stack, starting in a buffer on the C stack */
+#define WALK_INIT(c, local) \
+    do { \
+        (c).stack = (char *)(local); \
+        (c).size = sizeof(local); \
+        (c).top = 0; \
+        (c).borrowed = 1; \
+        (c).stats = NULL; \
+        (c).stack_alloc = &lept_std_allocator; \
+    } while(0)
+#define WALK_FREE(c)       lept_context_free(&(c))
+#define WALK_TOP(c, type)  ((type *)((c).stack + (c).top) - 1)
+
+#ifndef LEPT_WALK_LOCAL_SIZE
+#define LEPT_WALK_LOCAL_SIZE 32
+#endif
+
 static void lept_parse_whitespace(lept_context *c) {
     const char *p = c->json;
     while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
@@ -45,14 +361,102 @@ static int lept_parse_literal(lept_context *c, lept_value *v,
     return LEPT_PARSE_OK;
 }
 
-static int lept_parse_number(lept_context *c, lept_value *v) {
-    const char *p = c->json;
+static int lept_skip_number(const char **json, const char *end);
+
+/*
+ * Stores the integer n read from `len` digits if it fits in an int64 or a
+ * uint64 (n has wrapped if it does not). "-0" is left to be a double.
+ */
+static int lept_set_integer(lept_value *v, int neg, uint64_t n, const char *digits, size_t len) {
+    if (len > 20 || (len == 20 && memcmp(digits, "18446744073709551615", 20) > 0))
+        return 0;
+    if (neg) {
+        if (n == 0 || n > (uint64_t)INT64_MAX + 1)
+            return 0;
+        v->u.i64 = n == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)n;
+        v->flags = LEPT_VALUE_INT64;
+    } else if (n <= INT64_MAX) {
+        v->u.i64 = (int64_t)n;
+        v->flags = LEPT_VALUE_INT64;
+    } else {
+        v->u.u64 = n;
+        v->flags = LEPT_VALUE_UINT64;
+    }
+    v->type = LEPT_NUMBER;
+    return 1;
+}
+
+/* strtod of the validated lexeme [begin, end), from a copy; *range is set on overflow */
+static double lept_strtod_copy(const char *begin, const char *end, int *range) {
+    char local[64], *buf = local;
+    size_t len = (size_t)(end - begin);
+    double n;
+    if (len >= sizeof(local))
+        buf = (char *)malloc(len + 1);
+    memcpy(buf, begin, len);
+    buf[len] = '\0';
+    errno = 0;
+    n = strtod(buf, NULL);
+    *range = errno == ERANGE && (n == HUGE_VAL || n == -HUGE_VAL);
+    if (buf != local)
+        free(buf);
+    return n;
+}
+
+/*
+ * The same for a lexeme in '\0'-terminated text, read in place unless
+ * strtod would go on past its end. In a stream of documents that happens
+ * after a leading zero: "-0" then "1", or "0" then "x1".
+ */
+static double lept_strtod(const char *begin, const char *end, int *range) {
+    double n;
+    if (ISDIGIT(*end) || *end == 'x' || *end == 'X')
+        return lept_strtod_copy(begin, end, range);
+    errno = 0;
+    n = strtod(begin, NULL);
+    *range = errno == ERANGE && (n == HUGE_VAL || n == -HUGE_VAL);
+    return n;
+}
+
+/*
+ * The length of the number at p, which was validated: scanned again by the
+ * same grammar, as in a stream it may run straight into the next number
+ * ("1.5-2.5" is 1.5 then -2.5).
+ */
+static size_t lept_number_length(const char *p) {
+    const char *q = p;
+    if (*q == '-') ++q;
+    if (*q == '0')
+        ++q;
+    else
+        while (ISDIGIT(*q)) ++q;
+    if (*q == '.')
+        for (++q; ISDIGIT(*q); ++q) ; /* no code segment */
+    if (*q == 'e' || *q == 'E') {
+        ++q;
+        if (*q == '+' || *q == '-') ++q;
+        while (ISDIGIT(*q)) ++q;
+    }
+    return (size_t)(q - p);
+}
+
+static int lept_parse_number_raw(lept_context *c, lept_value *v) {
+    const char *p = c->json, *digits;
+    uint64_t n = 0;
+    int range;
     if (*p == '-') ++p;
+    digits = p;
     if (*p == '0') {
         ++p;
     } else {
         if (!ISDIGIT1TO9(*p)) return LEPT_PARSE_INVALID_VALUE;
-        for (++p; ISDIGIT(*p); ++p) ; /* no code segment */
+        for (n = (uint64_t)(*p++ - '0'); ISDIGIT(*p); ++p)
+            n = n * 10 + (uint64_t)(*p - '0');
+    }
+    if (*p != '.' && *p != 'e' && *p != 'E' &&
+        lept_set_integer(v, *c->json == '-', n, digits, (size_t)(p - digits))) {
+        c->json = p;
+        return LEPT_PARSE_OK;
     }
     if (*p == '.') {
         ++p;
@@ -65,140 +469,875 @@ static int lept_parse_number(lept_context *c, lept_value *v) {
         if (!ISDIGIT(*p)) return LEPT_PARSE_INVALID_VALUE;
         for (++p; ISDIGIT(*p); ++p) ; /* no code segment */
     }
+    if (c->flags & LEPT_PARSE_LAZY_NUMBERS) {
+        const char *q = c->json;
+        int ret = lept_skip_number(&q, p); /* only to tell if it is too big */
+        if (ret != LEPT_PARSE_OK)
+            return ret;
+        v->u.r.p = c->json;
+        c->json = p;
+        v->type = LEPT_NUMBER;
+        v->flags = LEPT_VALUE_RAW;
+        return LEPT_PARSE_OK;
+    }
 
-    errno = 0;
-    v->u.n = strtod(c->json, NULL);
-    if (errno == ERANGE && (v->u.n == HUGE_VAL || v->u.n == -HUGE_VAL))
+    v->u.n = lept_strtod(c->json, p, &range);
+    if (range)
         return LEPT_PARSE_NUMBER_TOO_BIG;
     c->json = p;
     v->type = LEPT_NUMBER;
+    v->flags = 0;
     return LEPT_PARSE_OK;
 }
 
-void lept_free(lept_value *v) {
-    assert(v != NULL);
-    if (v->type == LEPT_STRING) {
-        free(v->u.s.s);
-    } else if (v->type == LEPT_ARRAY) {
-        for (size_t index = 0; index < lept_get_array_size(v); ++index)
-            lept_free(lept_get_array_element(v, index));
-        free(v->u.a.e);
-    } else if (v->type == LEPT_OBJECT) {
-        for (size_t index = 0; index < lept_get_object_size(v); ++index) {
-            free((v->u.o.m + index) -> k);
-            lept_free(lept_get_object_value(v, index));
-        }
-        free(v->u.o.m);
-    }
-    v->type = LEPT_NULL;
-}
+/* bytes that end a run of plain string characters */
+#define ISPLAIN(ch)        ((unsigned char)(ch) >= 0x20 && (ch) != '\"' && (ch) != '\\')
 
-int lept_get_boolean(const lept_value *v) {
-    assert(v != NULL && (v->type == LEPT_TRUE || v->type == LEPT_FALSE));
-    return v->type - LEPT_FALSE;
+#if defined(__SSSE3__)
+
+/*
+ * Lookup-table UTF-8 validation (Keiser & Lemire): three nibble-indexed
+ * tables classify every pair of adjacent bytes, and a saturating subtract
+ * marks where the third and fourth bytes of a sequence must sit.
+ */
+#define U8_TOO_SHORT  0x01
+#define U8_TOO_LONG   0x02
+#define U8_OVERLONG_3 0x04
+#define U8_TOO_LARGE  0x08
+#define U8_SURROGATE  0x10
+#define U8_OVERLONG_2 0x20
+#define U8_LARGE_1000 0x40
+#define U8_OVERLONG_4 0x40
+#define U8_TWO_CONTS  0x80
+#define U8_CARRY      (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+static __m128i lept_utf8_check_block(__m128i in, __m128i prev) {
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        (char)U8_TWO_CONTS, (char)U8_TWO_CONTS,
+        (char)U8_TWO_CONTS, (char)U8_TWO_CONTS,
+        U8_TOO_SHORT | U8_OVERLONG_2,
+        U8_TOO_SHORT,
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_LARGE_1000 | U8_OVERLONG_4);
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        (char)(U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4),
+        (char)(U8_CARRY | U8_OVERLONG_2),
+        (char)U8_CARRY, (char)U8_CARRY,
+        (char)(U8_CARRY | U8_TOO_LARGE),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000 | U8_SURROGATE),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000),
+        (char)(U8_CARRY | U8_TOO_LARGE | U8_LARGE_1000));
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS |
+               U8_OVERLONG_3 | U8_LARGE_1000 | U8_OVERLONG_4),
+        (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS |
+               U8_OVERLONG_3 | U8_TOO_LARGE),
+        (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS |
+               U8_SURROGATE | U8_TOO_LARGE),
+        (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS |
+               U8_SURROGATE | U8_TOO_LARGE),
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT);
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i special = _mm_and_si128(_mm_and_si128(
+        _mm_shuffle_epi8(byte_1_high_table,
+                         _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble)),
+        _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, low_nibble))),
+        _mm_shuffle_epi8(byte_2_high_table,
+                         _mm_and_si128(_mm_srli_epi16(in, 4), low_nibble)));
+    __m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14),
+                                  _mm_set1_epi8(0xE0 - 0x80));
+    __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13),
+                                   _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(third, fourth),
+                                                 _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must_be_continuation, special);
 }
 
-void lept_set_boolean(lept_value *v, int b) {
-    assert(v != NULL);
-    lept_free(v);
-    v->type = b ? LEPT_TRUE : LEPT_FALSE;
+static int lept_utf8_valid(const char *s, size_t len) {
+    const __m128i incomplete_max = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m128i prev = _mm_setzero_si128(), error = prev, incomplete = prev, in;
+    char tail[16];
+    size_t i;
+    for (i = 0; i + 16 <= len; i += 16) {
+        in = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(in) == 0) {
+            error = _mm_or_si128(error, incomplete);
+        } else {
+            error = _mm_or_si128(error, lept_utf8_check_block(in, prev));
+            incomplete = _mm_subs_epu8(in, incomplete_max);
+        }
+        prev = in;
+    }
+    /* the zero padding also rejects a sequence cut off at the end */
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, s + i, len - i);
+    in = _mm_loadu_si128((const __m128i *)tail);
+    error = _mm_or_si128(error, lept_utf8_check_block(in, prev));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
 }
 
-double lept_get_number(const lept_value *v) {
-    assert(v != NULL && (v->type == LEPT_NUMBER));
-    return v->u.n;
+#else
+
+/* second-byte range of each lead byte, Unicode Table 3-7 */
+static const unsigned char lept_utf8_lead[64][3] = {
+    {0}, {0}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF}, {2, 0x80, 0xBF},
+    {3, 0xA0, 0xBF}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF},
+    {3, 0x80, 0xBF}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF},
+    {3, 0x80, 0xBF}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF},
+    {3, 0x80, 0xBF}, {3, 0x80, 0x9F}, {3, 0x80, 0xBF}, {3, 0x80, 0xBF},
+    {4, 0x90, 0xBF}, {4, 0x80, 0xBF}, {4, 0x80, 0xBF}, {4, 0x80, 0xBF},
+    {4, 0x80, 0x8F}
+};
+
+static int lept_utf8_valid(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s, *end = p + len;
+    while (p < end) {
+        const unsigned char *lead;
+        uint64_t word;
+        if (end - p >= 8) {
+            memcpy(&word, p, 8);
+            if ((word & 0x8080808080808080ull) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        if (*p < 0x80) {
+            ++p;
+            continue;
+        }
+        if (*p < 0xC0 || (lead = lept_utf8_lead[*p - 0xC0])[0] == 0 ||
+            end - p < lead[0] || p[1] < lead[1] || p[1] > lead[2])
+            return 0;
+        for (size_t i = 2; i < lead[0]; ++i)
+            if ((p[i] & 0xC0) != 0x80)
+                return 0;
+        p += lead[0];
+    }
+    return 1;
 }
 
-void lept_set_number(lept_value *v, double n){
-    assert(v != NULL);
-    lept_free(v);
-    v->type = LEPT_NUMBER;
-    v->u.n = n;
+#endif
+
+#ifndef LEPT_SKIP_STACK_INIT_SIZE
+#define LEPT_SKIP_STACK_INIT_SIZE 32
+#endif
+
+#define PEEK(p, end) ((p) < (end) ? *(p) : '\0')
+
+/*
+ * The lept_skip_* functions check the grammar of [*json, end) exactly like
+ * the lept_parse_* ones, but decode nothing and allocate nothing. On return
+ * *json points past the value, or at the offending byte on error.
+ */
+
+static void lept_skip_whitespace(const char **json, const char *end) {
+    const char *p = *json;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        ++p;
+    *json = p;
 }
 
-void lept_set_string(lept_value *v, const char *s, size_t len) {
-    assert((v != NULL) && (s != NULL || len == 0));
-    lept_free(v);
-    v->u.s.s = (char *)malloc(sizeof(char) * (len + 1));
-    memcpy(v->u.s.s, s, len);
-    v->u.s.s[len] = '\0';
-    v->u.s.len = len;
-    v->type = LEPT_STRING;
+static int lept_skip_literal(const char **json, const char *end,
+                             const char *literal) {
+    const char *p = *json;
+    for (; *literal; ++p, ++literal)
+        if (p == end || *p != *literal) {
+            *json = p;
+            return LEPT_PARSE_INVALID_VALUE;
+        }
+    *json = p;
+    return LEPT_PARSE_OK;
 }
 
-const char *lept_get_string(const lept_value *v) {
-    assert(v != NULL && v->type == LEPT_STRING);
-    return v->u.s.s;
+/* only a lexeme whose leading digit is at 10^308 or above needs strtod */
+static int lept_skip_number_too_big(const char *begin, const char *end) {
+    int range;
+    lept_strtod_copy(begin, end, &range);
+    return range;
 }
 
-size_t lept_get_string_length(const lept_value *v) {
-    assert(v != NULL && v->type == LEPT_STRING);
-    return v->u.s.len;
+static int lept_skip_number(const char **json, const char *end) {
+    const char *p = *json;
+    long magnitude = -1, exponent = 0;
+    int negative = 0;
+    if (PEEK(p, end) == '-') ++p;
+    if (PEEK(p, end) == '0') {
+        ++p;
+    } else {
+        if (!ISDIGIT1TO9(PEEK(p, end))) goto invalid;
+        for (++p, magnitude = 0; ISDIGIT(PEEK(p, end)); ++p)
+            ++magnitude;
+    }
+    if (PEEK(p, end) == '.') {
+        ++p;
+        if (!ISDIGIT(PEEK(p, end))) goto invalid;
+        for (; ISDIGIT(PEEK(p, end)); ++p) ; /* no code segment */
+    }
+    if (PEEK(p, end) == 'e' || PEEK(p, end) == 'E') {
+        ++p;
+        if (PEEK(p, end) == '+' || PEEK(p, end) == '-') negative = *p++ == '-';
+        if (!ISDIGIT(PEEK(p, end))) goto invalid;
+        for (; ISDIGIT(PEEK(p, end)); ++p)
+            if (exponent < 100000)
+                exponent = exponent * 10 + (*p - '0');
+    }
+    /*
+     * magnitude is the power of ten of the leading integer digit, -1 for 0.x,
+     * and a long enough one overflows even with a negative exponent
+     */
+    if (magnitude + (negative ? -exponent : exponent) >= 308 &&
+        lept_skip_number_too_big(*json, p))
+        return LEPT_PARSE_NUMBER_TOO_BIG;
+    *json = p;
+    return LEPT_PARSE_OK;
+invalid:
+    *json = p;
+    return LEPT_PARSE_INVALID_VALUE;
 }
 
-static void *lept_context_push(lept_context *c, size_t size) {
-    void *ret;
-    assert(size > 0);
-    if(c->top + size > c->size) {
-        if (c->size == 0)
-            c->size = LEPT_PARSE_STACK_INIT_SIZE;
-        else
-            while (c->top + size > c->size)
-                c->size += c->size >> 2;
-        c->stack = (char *)realloc(c->stack, c->size);
+static const char *lept_parse_hex4(const char *p, unsigned *u);
+
+static int lept_skip_string(const char **json, const char *end, unsigned flags) {
+    const char *p = *json + 1;
+    unsigned u;
+    int ret;
+    while (1) {
+        if (p == end) {
+            ret = LEPT_PARSE_MISS_QUOTATION_MARK;
+            break;
+        }
+        const unsigned char ch = *p++;
+        if (ch == '\"') {
+            *json = p;
+            return LEPT_PARSE_OK;
+        } else if (ch == '\\') {
+            switch (PEEK(p, end)) {
+                case '\"': case '\\': case '/':
+                case 'b': case 'f': case 'n': case 'r': case 't':
+                    ++p;
+                    continue;
+                case 'u':
+                    ++p;
+                    break;
+                default:
+                    ret = LEPT_PARSE_INVALID_STRING_ESCAPE;
+                    goto error;
+            }
+            if (end - p < 4 || !(p = lept_parse_hex4(p, &u))) {
+                ret = LEPT_PARSE_INVALID_UNICODE_HEX;
+                break;
+            }
+            if (u >= 0xD800 && u <= 0xDBFF) {
+                if (!(end - p >= 2 && p[0] == '\\' && p[1] == 'u')) {
+                    ret = LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+                    break;
+                }
+                p += 2;
+                if (end - p < 4 || !(p = lept_parse_hex4(p, &u))) {
+                    ret = LEPT_PARSE_INVALID_UNICODE_HEX;
+                    break;
+                }
+                if (!(u >= 0xDC00 && u <= 0xDFFF)) {
+                    ret = LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+                    break;
+                }
+            } else if (u >= 0xDC00 && u <= 0xDFFF &&
+                       (flags & LEPT_PARSE_VALIDATE_UTF8)) {
+                ret = LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+                break;
+            }
+        } else if (ch >= 0x80 && (flags & LEPT_PARSE_VALIDATE_UTF8)) {
+            const char *run = --p;
+            while (p < end && ISPLAIN(*p))
+                ++p;
+            if (!lept_utf8_valid(run, p - run)) {
+                p = run;
+                ret = LEPT_PARSE_INVALID_UTF8;
+                break;
+            }
+        } else if (ch < 0x20) {
+            --p;
+            ret = ch == '\0' ? LEPT_PARSE_MISS_QUOTATION_MARK
+                             : LEPT_PARSE_INVALID_STRING_CHAR;
+            break;
+        }
     }
-    ret = c->stack + c->top;
-    c->top += size;
+error:
+    *json = p;
     return ret;
 }
 
-static void *lept_context_pop(lept_context *c, size_t size) {
-    assert(c->top >= size);
-    return c->stack + (c->top -= size);
+/* object member name, colon and the whitespace around them */
+static int lept_skip_key(const char **json, const char *end, unsigned flags) {
+    int ret;
+    if (PEEK(*json, end) != '\"')
+        return LEPT_PARSE_MISS_KEY;
+    if ((ret = lept_skip_string(json, end, flags)) != LEPT_PARSE_OK)
+        return ret;
+    lept_skip_whitespace(json, end);
+    if (PEEK(*json, end) != ':')
+        return LEPT_PARSE_MISS_COLON;
+    ++*json;
+    lept_skip_whitespace(json, end);
+    return LEPT_PARSE_OK;
 }
 
-static const char *lept_parse_hex4(const char *p, unsigned *u) {
-    *u = 0;
-    for(size_t i = 0; i < 4; ++i) {
-        char ch = *p++;
-        *u <<= 4;
-        if      ('0' <= ch && ch <= '9') *u += ch - '0';
-        else if ('A' <= ch && ch <= 'F') *u += ch - 'A' + 10;
-        else if ('a' <= ch && ch <= 'f') *u += ch - 'a' + 10;
-        else    return NULL;
+/*
+ * Nesting is tracked as one bit per level (1 for object), in a small buffer
+ * on the C stack that only moves to the heap for unusually deep input.
+ */
+static int lept_skip_value(const char **json, const char *end, unsigned flags,
+                           size_t max_depth) {
+    unsigned char local[LEPT_SKIP_STACK_INIT_SIZE], *bits = local;
+    size_t depth = 0, cap = sizeof(local) * 8;
+    const char *p = *json;
+    int ret = LEPT_PARSE_OK;
+    while (ret == LEPT_PARSE_OK) {
+        char ch = PEEK(p, end);
+        switch (ch) {
+            case 'n':  ret = lept_skip_literal(&p, end, "null");  break;
+            case 't':  ret = lept_skip_literal(&p, end, "true");  break;
+            case 'f':  ret = lept_skip_literal(&p, end, "false"); break;
+            case '\"': ret = lept_skip_string(&p, end, flags);    break;
+            case '\0': ret = LEPT_PARSE_EXPECT_VALUE;             break;
+            default:   ret = lept_skip_number(&p, end);           break;
+            case '[':
+            case '{':
+                if (depth == max_depth) {
+                    ret = LEPT_PARSE_NESTING_TOO_DEEP;
+                    break;
+                }
+                if (depth == cap) {
+                    unsigned char *grown = (unsigned char *)malloc(cap / 4);
+                    memcpy(grown, bits, cap / 8);
+                    if (bits != local)
+                        free(bits);
+                    bits = grown;
+                    cap *= 2;
+                }
+                if (ch == '{')
+                    bits[depth / 8] |= (unsigned char)(1u << depth % 8);
+                else
+                    bits[depth / 8] &= (unsigned char)~(1u << depth % 8);
+                ++depth;
+                ++p;
+                lept_skip_whitespace(&p, end);
+                if (PEEK(p, end) == (ch == '{' ? '}' : ']')) {
+                    ++p;
+                    --depth;
+                } else {
+                    if (ch == '{')
+                        ret = lept_skip_key(&p, end, flags);
+                    continue;
+                }
+                break;
+        }
+        /* a value is complete: consume separators and closing brackets */
+        while (ret == LEPT_PARSE_OK && depth > 0) {
+            int is_object = bits[(depth - 1) / 8] >> (depth - 1) % 8 & 1;
+            lept_skip_whitespace(&p, end);
+            if (PEEK(p, end) == ',') {
+                ++p;
+                lept_skip_whitespace(&p, end);
+                if (is_object)
+                    ret = lept_skip_key(&p, end, flags);
+                break;
+            } else if (PEEK(p, end) == (is_object ? '}' : ']')) {
+                ++p;
+                --depth;
+            } else {
+                ret = is_object ? LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+                                : LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            }
+        }
+        if (depth == 0)
+            break;
     }
-    return p;
+    if (bits != local)
+        free(bits);
+    *json = p;
+    return ret;
 }
 
-static void lept_encode_utf8(lept_context *c, unsigned u) {
-    assert(u <= 0x10FFFF);
-    if (u <= 0x7F) {
-        PUTC(c, u);
-    } else if (u <= 0x7FF) {
-        PUTC(c, 0xC0 | ((u >> 6) & 0x1F));
-        PUTC(c, 0x80 | ( u       & 0x3F));
-    } else if (u <= 0xFFFF) {
-        PUTC(c, 0xE0 | ((u >> 12) & 0x0F));
-        PUTC(c, 0X80 | ((u >>  6) & 0x3F));
-        PUTC(c, 0X80 | ( u        & 0x3F));
-    } else {
-        PUTC(c, 0xF0 | ((u >> 18) & 0x07));
-        PUTC(c, 0x80 | ((u >> 12) & 0x3F));
-        PUTC(c, 0x80 | ((u >>  6) & 0x3F));
-        PUTC(c, 0x80 | ( u        & 0x3F));
+int lept_validate(const char *json, size_t len, size_t *offset) {
+    const char *p = json, *end = json + len;
+    int ret;
+    assert(json != NULL || len == 0);
+    lept_skip_whitespace(&p, end);
+    if ((ret = lept_skip_value(&p, end, 0, LEPT_PARSE_MAX_DEPTH)) == LEPT_PARSE_OK) {
+        lept_skip_whitespace(&p, end);
+        if (p != end)
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
     }
+    if (offset)
+        *offset = p - json;
+    return ret;
+}
+
+static int lept_parse_skip(lept_context *c) {
+    return lept_skip_value(&c->json, c->end, c->flags, c->max_depth - c->depth);
+}
+
+/* packed arrays have no lept_value children, so walks take them as leaves */
+#define ISCONTAINER(x) (((x)->type == LEPT_ARRAY && !((x)->flags & LEPT_VALUE_PACKED)) || \
+                        (x)->type == LEPT_OBJECT)
+#define ISPACKED(x)    ((x)->type == LEPT_ARRAY && ((x)->flags & LEPT_VALUE_PACKED))
+#define CHILDREN(x)    ((x)->type == LEPT_ARRAY ? (x)->u.a.size : (x)->u.o.size)
+#define CHILD(x, i)    ((x)->type == LEPT_ARRAY ? &(x)->u.a.e[i] : &(x)->u.o.m[i].v)
+
+/*
+ * The walks over a tree below are iterative: every container being visited
+ * is a frame on a small work stack, which only moves to the heap for deep
+ * documents, so neither depth nor size touch the C stack.
+ */
+typedef struct {
+    lept_value *v;
+    size_t i;
+} lept_free_frame;
+
+/*
+ * Starts freeing v: a string or packed array goes at once, a container is
+ * pushed as a frame for lept_free_walk. Bodies still shared with other
+ * values are left to them. Returns the bytes given back.
+ */
+static size_t lept_free_enter(lept_context *c, lept_value *v) {
+    lept_free_frame *f;
+    if (v->type == LEPT_STRING) {
+        if (lept_value_unref(v, v->u.s.s)) {
+            lept_value_release(v, v->u.s.s, v->u.s.len + 1);
+            return v->u.s.len + 1;
+        }
+    } else if (ISPACKED(v)) {
+        if (lept_value_unref(v, v->u.a.e)) {
+            lept_value_release(v, v->u.a.e, v->u.a.size * PACKED_SIZE);
+            return v->u.a.size * PACKED_SIZE;
+        }
+    } else if (ISCONTAINER(v) && CHILDREN(v) > 0 && lept_value_unref(v, lept_value_body(v))) {
+        f = (lept_free_frame *)lept_context_push(c, sizeof(lept_free_frame));
+        f->v = v;
+        f->i = 0;
+    }
+    return 0;
+}
+
+/*
+ * Frees the children of the frames on c until none are left, or until more
+ * than `budget` bytes have been counted; a later call carries on where this
+ * one stopped. Each child counts for its slot in the body of its parent,
+ * its key and its string, so that a whole tree adds up to its bytes.
+ */
+static size_t lept_free_walk(lept_context *c, size_t budget) {
+    size_t freed = 0;
+    while (c->top > 0 && freed <= budget) {
+        lept_free_frame *f = WALK_TOP(*c, lept_free_frame);
+        lept_value *e;
+        if (f->i == CHILDREN(f->v)) {
+            if (f->v->type == LEPT_ARRAY)
+                lept_value_release(f->v, f->v->u.a.e, f->i * sizeof(lept_value));
+            else
+                lept_value_release(f->v, f->v->u.o.m, f->i * sizeof(lept_member));
+            lept_context_pop(c, sizeof(lept_free_frame));
+            continue;
+        }
+        if (f->v->type == LEPT_OBJECT) {
+            lept_member *m = &f->v->u.o.m[f->i];
+            freed += sizeof(lept_member) + lept_key_release(m->k, m->klen);
+            e = &m->v;
+        } else {
+            freed += sizeof(lept_value);
+            e = &f->v->u.a.e[f->i];
+        }
+        ++f->i;
+        freed += lept_free_enter(c, e);
+    }
+    return freed;
+}
+
+void lept_free(lept_value *v) {
+    lept_free_frame local[LEPT_WALK_LOCAL_SIZE];
+    lept_context c;
+    assert(v != NULL);
+    WALK_INIT(c, local);
+    lept_free_enter(&c, v);
+    lept_free_walk(&c, (size_t)-1);
+    WALK_FREE(c);
+    v->type = LEPT_NULL;
+    v->hash = 0;
+}
+
+typedef struct lept_reclaim_node {
+    struct lept_reclaim_node *next;
+    lept_value v;
+    size_t bytes;  /* still counted in pending_bytes */
+} lept_reclaim_node;
+
+struct lept_reclaimer {
+    const lept_allocator *alloc;
+    lept_reclaim_node *head, *tail;
+    lept_context walk;  /* over head, once entered */
+    int entered;
+    size_t pending, pending_bytes;
+};
+
+lept_reclaimer *lept_reclaimer_create(const lept_allocator *a) {
+    lept_reclaimer *r;
+    if (a == NULL)
+        a = &lept_std_allocator;
+    r = (lept_reclaimer *)lept_malloc(a, sizeof(lept_reclaimer));
+    memset(r, 0, sizeof(lept_reclaimer));
+    r->alloc = a;
+    r->walk.stack_alloc = a;
+    return r;
+}
+
+void lept_reclaimer_destroy(lept_reclaimer *r) {
+    if (r == NULL)
+        return;
+    lept_reclaimer_flush(r);
+    lept_context_free(&r->walk);
+    lept_release(r->alloc, r, sizeof(lept_reclaimer));
+}
+
+void lept_reclaimer_defer(lept_reclaimer *r, lept_value *v, size_t bytes) {
+    lept_reclaim_node *n;
+    assert(r != NULL && v != NULL);
+    if (lept_value_body(v) == NULL) {
+        lept_free(v);
+        return;
+    }
+    n = (lept_reclaim_node *)lept_malloc(r->alloc, sizeof(lept_reclaim_node));
+    n->next = NULL;
+    memcpy(&n->v, v, sizeof(lept_value));
+    n->bytes = bytes;
+    if (r->tail != NULL)
+        r->tail->next = n;
+    else
+        r->head = n;
+    r->tail = n;
+    ++r->pending;
+    r->pending_bytes += bytes;
+    lept_init(v);
+}
+
+size_t lept_reclaimer_drain(lept_reclaimer *r, size_t budget) {
+    size_t freed = 0;
+    assert(r != NULL);
+    while (r->head != NULL && freed <= budget) {
+        lept_reclaim_node *n = r->head;
+        size_t step = 0;
+        if (!r->entered) {
+            step = lept_free_enter(&r->walk, &n->v);
+            r->entered = 1;
+        }
+        step += lept_free_walk(&r->walk, budget - freed);
+        freed += step;
+        if (step > n->bytes)
+            step = n->bytes;
+        n->bytes -= step;
+        r->pending_bytes -= step;
+        if (r->walk.top == 0) {
+            r->pending_bytes -= n->bytes;
+            --r->pending;
+            r->entered = 0;
+            if ((r->head = n->next) == NULL)
+                r->tail = NULL;
+            lept_release(r->alloc, n, sizeof(lept_reclaim_node));
+        }
+    }
+    return freed;
+}
+
+void lept_reclaimer_flush(lept_reclaimer *r) {
+    lept_reclaimer_drain(r, (size_t)-1);
+}
+
+size_t lept_reclaimer_pending(const lept_reclaimer *r) {
+    assert(r != NULL);
+    return r->pending;
+}
+
+size_t lept_reclaimer_pending_bytes(const lept_reclaimer *r) {
+    assert(r != NULL);
+    return r->pending_bytes;
+}
+
+#if LEPT_ENABLE_STATS
+/*
+ * Counts the values, depth and heap blocks of a tree after the fact, which
+ * keeps the per-value cost out of the parse and stringify loops.
+ */
+static void lept_stats_tree(lept_stats *st, const lept_value *v, int allocs) {
+    lept_free_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    WALK_INIT(walk, local);
+    while (1) {
+        ++st->values[v->type];
+        if (v->type == LEPT_STRING && allocs) {
+            ++st->allocs;
+            st->alloc_bytes += v->u.s.len + 1;
+        } else if (ISPACKED(v)) {
+            st->values[LEPT_NUMBER] += v->u.a.size;
+            if (allocs) {
+                ++st->allocs;
+                st->alloc_bytes += v->u.a.size * PACKED_SIZE;
+            }
+        } else if (ISCONTAINER(v)) {
+            size_t n = CHILDREN(v);
+            if (allocs && n != 0) {
+                ++st->allocs;
+                st->alloc_bytes += n * (v->type == LEPT_ARRAY ? sizeof(lept_value)
+                                                              : sizeof(lept_member));
+            }
+            f = (lept_free_frame *)lept_context_push(&walk, sizeof(lept_free_frame));
+            f->v = (lept_value *)v;
+            f->i = 0;
+            if (walk.top / sizeof(lept_free_frame) > st->max_depth)
+                st->max_depth = walk.top / sizeof(lept_free_frame);
+        }
+        v = NULL;
+        while (walk.top > 0) {
+            f = WALK_TOP(walk, lept_free_frame);
+            if (f->i == CHILDREN(f->v)) {
+                lept_context_pop(&walk, sizeof(lept_free_frame));
+                continue;
+            }
+            v = CHILD(f->v, f->i++);
+            break;
+        }
+        if (v == NULL)
+            break;
+    }
+    WALK_FREE(walk);
+}
+#endif
+
+int lept_get_boolean(const lept_value *v) {
+    assert(v != NULL && (v->type == LEPT_TRUE || v->type == LEPT_FALSE));
+    return v->type - LEPT_FALSE;
+}
+
+void lept_set_boolean(lept_value *v, int b) {
+    assert(v != NULL);
+    lept_free(v);
+    v->type = b ? LEPT_TRUE : LEPT_FALSE;
+}
+
+double lept_get_number(const lept_value *v) {
+    assert(v != NULL && (v->type == LEPT_NUMBER));
+    if (v->flags & LEPT_VALUE_RAW) {
+        if (!(v->flags & LEPT_VALUE_DECODED)) {
+            lept_value *w = (lept_value *)v; /* only the cache changes */
+            int range;
+            w->u.r.n = lept_strtod(v->u.r.p, v->u.r.p + lept_number_length(v->u.r.p), &range);
+            w->flags |= LEPT_VALUE_DECODED;
+        }
+        return v->u.r.n;
+    }
+    if (v->flags & LEPT_VALUE_INT64)
+        return (double)v->u.i64;
+    if (v->flags & LEPT_VALUE_UINT64)
+        return (double)v->u.u64;
+    return v->u.n;
+}
+
+lept_number_type lept_get_number_type(const lept_value *v) {
+    assert(v != NULL && (v->type == LEPT_NUMBER));
+    return v->flags & LEPT_VALUE_INT64  ? LEPT_NUMBER_INT64 :
+           v->flags & LEPT_VALUE_UINT64 ? LEPT_NUMBER_UINT64 : LEPT_NUMBER_DOUBLE;
+}
+
+int64_t lept_get_int64(const lept_value *v) {
+    assert(v != NULL && v->type == LEPT_NUMBER && (v->flags & LEPT_VALUE_INT64));
+    return v->u.i64;
+}
+
+uint64_t lept_get_uint64(const lept_value *v) {
+    assert(v != NULL && v->type == LEPT_NUMBER && ((v->flags & LEPT_VALUE_UINT64) ||
+           ((v->flags & LEPT_VALUE_INT64) && v->u.i64 >= 0)));
+    return v->flags & LEPT_VALUE_UINT64 ? v->u.u64 : (uint64_t)v->u.i64;
+}
+
+void lept_set_int64(lept_value *v, int64_t n) {
+    assert(v != NULL);
+    lept_free(v);
+    v->type = LEPT_NUMBER;
+    v->flags = LEPT_VALUE_INT64;
+    v->u.i64 = n;
+}
+
+void lept_set_uint64(lept_value *v, uint64_t n) {
+    assert(v != NULL);
+    lept_free(v);
+    v->type = LEPT_NUMBER;
+    if (n <= INT64_MAX) {
+        v->flags = LEPT_VALUE_INT64;
+        v->u.i64 = (int64_t)n;
+    } else {
+        v->flags = LEPT_VALUE_UINT64;
+        v->u.u64 = n;
+    }
+}
+
+/*
+ * The value of an integral number as sign and magnitude, false for doubles
+ * that are not integers in [-2^63, 2^64). Equality and hashing go through
+ * it, so 1, 1.0 and 1e0 are all the same number.
+ */
+static int lept_number_integer(const lept_value *v, int *neg, uint64_t *mag) {
+    double n = v->flags & LEPT_VALUE_RAW ? lept_get_number(v) : v->u.n;
+    if (v->flags & LEPT_VALUE_INT64) {
+        *neg = v->u.i64 < 0;
+        *mag = *neg ? 0 - (uint64_t)v->u.i64 : (uint64_t)v->u.i64;
+        return 1;
+    }
+    if (v->flags & LEPT_VALUE_UINT64) {
+        *neg = 0;
+        *mag = v->u.u64;
+        return 1;
+    }
+    if (n >= -9223372036854775808.0 && n < 9223372036854775808.0) {
+        int64_t i = (int64_t)n;
+        if ((double)i != n)
+            return 0;
+        *neg = i < 0;
+        *mag = *neg ? 0 - (uint64_t)i : (uint64_t)i;
+        return 1;
+    }
+    if (n >= 9223372036854775808.0 && n < 18446744073709551616.0) {
+        *neg = 0; /* doubles this large are all integers */
+        *mag = (uint64_t)n;
+        return 1;
+    }
+    return 0;
+}
+
+void lept_set_number(lept_value *v, double n){
+    assert(v != NULL);
+    lept_free(v);
+    v->type = LEPT_NUMBER;
+    v->flags = 0;
+    v->u.n = n;
+}
+
+static void lept_set_string_a(lept_value *v, const char *s, size_t len,
+                              const lept_allocator *a) {
+    v->u.s.s = (char *)lept_value_alloc(v, a, sizeof(char) * (len + 1));
+    if (len > 0)
+        memcpy(v->u.s.s, s, len);
+    v->u.s.s[len] = '\0';
+    v->u.s.len = len;
+    v->type = LEPT_STRING;
+}
+
+void lept_set_string(lept_value *v, const char *s, size_t len) {
+    assert((v != NULL) && (s != NULL || len == 0));
+    lept_free(v);
+    lept_set_string_a(v, s, len, &lept_std_allocator);
+}
+
+const char *lept_get_string(const lept_value *v) {
+    assert(v != NULL && v->type == LEPT_STRING);
+    return v->u.s.s;
+}
+
+size_t lept_get_string_length(const lept_value *v) {
+    assert(v != NULL && v->type == LEPT_STRING);
+    return v->u.s.len;
+}
+
+static const char *lept_parse_hex4(const char *p, unsigned *u) {
+    *u = 0;
+    for(size_t i = 0; i < 4; ++i) {
+        char ch = *p++;
+        *u <<= 4;
+        if      ('0' <= ch && ch <= '9') *u += ch - '0';
+        else if ('A' <= ch && ch <= 'F') *u += ch - 'A' + 10;
+        else if ('a' <= ch && ch <= 'f') *u += ch - 'a' + 10;
+        else    return NULL;
+    }
+    return p;
+}
+
+static void lept_encode_utf8(lept_context *c, unsigned u) {
+    assert(u <= 0x10FFFF);
+    if (u <= 0x7F) {
+        PUTC(c, u);
+    } else if (u <= 0x7FF) {
+        PUTC(c, 0xC0 | ((u >> 6) & 0x1F));
+        PUTC(c, 0x80 | ( u       & 0x3F));
+    } else if (u <= 0xFFFF) {
+        PUTC(c, 0xE0 | ((u >> 12) & 0x0F));
+        PUTC(c, 0X80 | ((u >>  6) & 0x3F));
+        PUTC(c, 0X80 | ( u        & 0x3F));
+    } else {
+        PUTC(c, 0xF0 | ((u >> 18) & 0x07));
+        PUTC(c, 0x80 | ((u >> 12) & 0x3F));
+        PUTC(c, 0x80 | ((u >>  6) & 0x3F));
+        PUTC(c, 0x80 | ( u        & 0x3F));
+    }
+}
+
+/*
+ * max_bytes counts what the parse asked the allocators for: the values
+ * built so far (c->used, block headers included) and the stack, all of it
+ * once this parse allocated it, else what it holds of a parser's stack.
+ */
+#define LEPT_PARSE_HELD(c) ((c)->used + ((c)->grown ? (c)->size : (c)->top))
+
+/* the bytes a string or body of size bytes takes from the allocator */
+#define LEPT_BODY_SIZE(c, size) \
+    ((size) + ((c)->alloc == &lept_std_allocator ? 0 : sizeof(lept_block)))
+
+/* whether size more bytes for a value keep the parse within max_bytes */
+static int lept_parse_fits(const lept_context *c, size_t size) {
+    size_t held = LEPT_PARSE_HELD(c);
+    return held <= c->max_bytes && size <= c->max_bytes - held;
+}
+
+/* makes room for size more bytes on the stack, growing it no further than the budget */
+static int lept_parse_reserve(lept_context *c, size_t size) {
+    if (c->top + size <= c->size)
+        return LEPT_PARSE_OK;
+    if (c->used > c->max_bytes || c->top + size > c->max_bytes - c->used)
+        return LEPT_PARSE_TOO_MUCH_MEMORY;
+    lept_context_grow(c, c->top + size, c->max_bytes - c->used);
+    return LEPT_PARSE_OK;
 }
 
 static int lept_parse_string_raw(lept_context *c, char **str, size_t *len) {
     size_t head = c->top;
     const char *p;
     unsigned u;
+    int ret;
     EXPECT(c, '\"');
     p = c->json;
     while (1) {
         const char ch = *(p++);
         switch (ch) {
             case '\"':
+                STAT_PEAK(c);
                 *len = c->top - head;
                 *str = (char *)lept_context_pop(c, *len);
                 c->json = p;
@@ -206,6 +1345,9 @@ static int lept_parse_string_raw(lept_context *c, char **str, size_t *len) {
             case '\0':
                 STRING_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK);
             case '\\':
+                /* an escape decodes to 4 bytes at most */
+                if ((ret = lept_parse_reserve(c, 4)) != LEPT_PARSE_OK)
+                    STRING_ERROR(ret);
                 switch (*p++) {
                     case '\"': PUTC(c, '\"'); break;
                     case '\\': PUTC(c, '\\'); break;
@@ -219,6 +1361,9 @@ static int lept_parse_string_raw(lept_context *c, char **str, size_t *len) {
                     case 'u':
                         if (!(p = lept_parse_hex4(p, &u)))
                             STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_HEX);
+                        if (u >= 0xDC00 && u <= 0xDFFF &&
+                            (c->flags & LEPT_PARSE_VALIDATE_UTF8))
+                            STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_SURROGATE);
                         if (u >= 0xD800 && u <= 0xDBFF) {
                             if (!(p[0] == '\\' && p[1] == 'u'))
                                 STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_SURROGATE);
@@ -233,166 +1378,656 @@ static int lept_parse_string_raw(lept_context *c, char **str, size_t *len) {
                         lept_encode_utf8(c, u);
                         break;
                 }
+                if (c->top - head > c->max_string_length)
+                    STRING_ERROR(LEPT_PARSE_STRING_TOO_LONG);
                 break;
             default:
                 if ((unsigned char)ch < 0x20)
                     STRING_ERROR(LEPT_PARSE_INVALID_STRING_CHAR);
-                PUTC(c, ch);
+                else {
+                    const char *run = p - 1;
+                    while (ISPLAIN(*p))
+                        ++p;
+                    if ((c->flags & LEPT_PARSE_VALIDATE_UTF8) &&
+                        !lept_utf8_valid(run, p - run))
+                        STRING_ERROR(LEPT_PARSE_INVALID_UTF8);
+                    if (c->top - head + (size_t)(p - run) > c->max_string_length)
+                        STRING_ERROR(LEPT_PARSE_STRING_TOO_LONG);
+                    if ((ret = lept_parse_reserve(c, p - run)) != LEPT_PARSE_OK)
+                        STRING_ERROR(ret);
+                    PUTS(c, run, p - run);
+                }
         }
     }
 }
 
+static int lept_parse_number(lept_context *c, lept_value *v) {
+    int ret;
+    STAT_START(c, start);
+    ret = lept_parse_number_raw(c, v);
+    STAT_STOP(c, number_ns, start);
+    return ret;
+}
+
 static int lept_parse_string(lept_context *c, lept_value *v) {
     int ret;
     char *s;
     size_t len;
+    STAT_START(c, start);
     if((ret = lept_parse_string_raw(c, &s, &len)) == LEPT_PARSE_OK) {
-        lept_set_string(v, s, len);
+        if (!lept_parse_fits(c, LEPT_BODY_SIZE(c, len + 1))) {
+            ret = LEPT_PARSE_TOO_MUCH_MEMORY;
+        } else {
+            lept_set_string_a(v, s, len, c->alloc);
+            c->used += LEPT_BODY_SIZE(c, len + 1);
+        }
         // s = NULL;
     }
+    STAT_STOP(c, string_ns, start);
     return ret;
 }
 
-static int lept_parse_value(lept_context *c, lept_value *v);
+#define FRAME(c) ((lept_frame *)((c)->stack + (c)->frame))
 
-static int lept_parse_array(lept_context *c, lept_value *v) {
-    EXPECT(c, '[');
-    size_t size = 0;
+/*
+ * Records repeat their shape: an array or object most likely has the keys
+ * (and nested shapes) of the one at the same place in the previous
+ * sibling, that is the previous element of an array or, inside such a
+ * record, the value of the same member. Its body stays put on the heap,
+ * so f keeps it to predict keys from.
+ */
+static void lept_parse_shape(lept_context *c, lept_frame *f) {
+    const lept_frame *p = (const lept_frame *)(c->stack + f->parent);
+    const lept_value *like = NULL;
+    if (p->type == LEPT_ARRAY) {
+        /* the pushed elements are right below f, the first one repeats p's */
+        if (p->size > 0)
+            like = (const lept_value *)f - 1;
+        else if (p->shape_size > 0)
+            like = (const lept_value *)p->shape;
+    } else if (p->size <= p->shape_size) {
+        const lept_member *m = (const lept_member *)f - 1;
+        const lept_member *sm = (const lept_member *)p->shape + p->size - 1;
+        if (m->k == sm->k)
+            like = &sm->v;
+    }
+    if (like != NULL && like->type == f->type && ISCONTAINER(like) && CHILDREN(like) > 0) {
+        f->shape = lept_value_body(like);
+        f->shape_size = CHILDREN(like);
+    }
+}
+
+static int lept_parse_open(lept_context *c, lept_type type) {
+    lept_frame *f;
     int ret;
+    if (c->depth == c->max_depth)
+        return LEPT_PARSE_NESTING_TOO_DEEP;
+    if ((ret = lept_parse_reserve(c, sizeof(lept_frame))) != LEPT_PARSE_OK)
+        return ret;
+    f = (lept_frame *)lept_context_push(c, sizeof(lept_frame));
+    f->parent = c->frame;
+    f->size = 0;
+    f->sel = c->sel;
+    f->type = type;
+    f->shape = NULL;
+    f->shape_size = 0;
+    if (c->sel == NULL && f->parent != LEPT_FRAME_NONE)
+        lept_parse_shape(c, f);
+    c->frame = (char *)f - c->stack;
+    ++c->depth;
+    ++c->json;
     lept_parse_whitespace(c);
-    if (*c->json == ']') {
-        ++(c->json);
-        v->type = LEPT_ARRAY;
-        v->u.a.size = 0;
-        v->u.a.e = NULL;
-        return LEPT_PARSE_OK;
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * Packs the n elements on top of the stack into v if they are all numbers:
+ * as int64_t when they all are, else as doubles if that loses nothing.
+ */
+static int lept_parse_pack(lept_context *c, lept_value *v, size_t n) {
+    const lept_value *e = (const lept_value *)(c->stack + c->top) - n;
+    int ints = 1, big = 0;
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        if (e[i].type != LEPT_NUMBER || (e[i].flags & (LEPT_VALUE_UINT64 | LEPT_VALUE_RAW)))
+            return 0;
+        if (!(e[i].flags & LEPT_VALUE_INT64))
+            ints = 0;
+        else if (e[i].u.i64 > ((int64_t)1 << 53) || e[i].u.i64 < -((int64_t)1 << 53))
+            big = 1;
     }
-    while (1) {
-        lept_value e;
-        lept_init(&e);
-        if ((ret = lept_parse_value(c, &e)) != LEPT_PARSE_OK)
-            break;
-        memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
-        ++size;
-        lept_parse_whitespace(c);
-        if (*c->json == ',') {
-            ++(c->json);
-            lept_parse_whitespace(c);
-        } else if (*c->json == ']') {
-            ++(c->json);
-            v->type = LEPT_ARRAY;
-            v->u.a.size = size;
-            size *= sizeof(lept_value);
-            memcpy(v->u.a.e = malloc(size), lept_context_pop(c, size), size);
-            return LEPT_PARSE_OK;
+    if ((!ints && big) || !lept_parse_fits(c, LEPT_BODY_SIZE(c, n * PACKED_SIZE)))
+        return 0;
+    v->u.a.e = (lept_value *)lept_value_alloc(v, c->alloc, n * PACKED_SIZE);
+    c->used += LEPT_BODY_SIZE(c, n * PACKED_SIZE);
+    v->flags |= LEPT_VALUE_PACKED | (ints ? LEPT_VALUE_INT64 : 0);
+    if (ints) {
+        int64_t *p = (int64_t *)v->u.a.e;
+        for (i = 0; i < n; ++i)
+            p[i] = e[i].u.i64;
+    } else {
+        double *p = (double *)v->u.a.e;
+        for (i = 0; i < n; ++i)
+            p[i] = e[i].flags & LEPT_VALUE_INT64 ? (double)e[i].u.i64 : e[i].u.n;
+    }
+    lept_context_pop(c, n * sizeof(lept_value));
+    return 1;
+}
+
+/*
+ * Moves the elements of the innermost container into v and pops its frame;
+ * a body over the budget leaves both on the stack for lept_parse_unwind.
+ */
+static int lept_parse_close(lept_context *c, lept_value *v) {
+    lept_frame *f = FRAME(c);
+    size_t size = f->size, parent = f->parent;
+    STAT_PEAK(c);
+    v->type = f->type;
+    v->flags = 0;
+    if (f->type == LEPT_ARRAY && size > 0 && (c->flags & LEPT_PARSE_PACK_NUMBERS) &&
+        lept_parse_pack(c, v, size)) {
+        v->u.a.size = size;
+    } else {
+        size *= f->type == LEPT_ARRAY ? sizeof(lept_value) : sizeof(lept_member);
+        if (size > 0 && !lept_parse_fits(c, LEPT_BODY_SIZE(c, size))) {
+            v->type = LEPT_NULL;
+            return LEPT_PARSE_TOO_MUCH_MEMORY;
+        }
+        if (f->type == LEPT_ARRAY) {
+            v->u.a.size = f->size;
+            v->u.a.e = size ? (lept_value *)memcpy(lept_value_alloc(v, c->alloc, size),
+                                                   lept_context_pop(c, size), size) : NULL;
         } else {
-            ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-            break;
+            v->u.o.size = f->size;
+            v->u.o.m = size ? (lept_member *)memcpy(lept_value_alloc(v, c->alloc, size),
+                                                    lept_context_pop(c, size), size) : NULL;
         }
+        if (size > 0)
+            c->used += LEPT_BODY_SIZE(c, size);
     }
-    for(size_t i = 0; i < size; ++i)
-        lept_free((lept_value *)lept_context_pop(c, sizeof(lept_value)));
-    return ret;
+    ++c->json;
+    lept_context_pop(c, sizeof(lept_frame));
+    assert(c->top == c->frame);
+    c->frame = parent;
+    --c->depth;
+    return LEPT_PARSE_OK;
+}
+
+/* steps over the key at c->json if it is m's, written without escapes */
+static int lept_parse_key_like(lept_context *c, const lept_member *m) {
+    const char *p = c->json + 1;
+    size_t i;
+    for (i = 0; i < m->klen; ++i)
+        if (p[i] != m->k[i] || !ISPLAIN(p[i]))
+            return 0;
+    if (p[i] != '\"')
+        return 0;
+    c->json = p + i + 1;
+    return 1;
 }
 
-static int lept_parse_object(lept_context *c, lept_value *v) {
-    EXPECT(c, '{');
-    size_t size = 0;
+/*
+ * Parses `"key" :` and pushes the member with a null value. Members the
+ * projection does not select are not pushed and *drop is set instead.
+ */
+static int lept_parse_member(lept_context *c, int *drop) {
+    const lept_frame *f = FRAME(c);
+    const lept_path_node *sel = f->sel, *child = NULL;
+    const lept_member *like;
+    lept_member *m;
+    char *str, *k = NULL;
+    size_t len;
     int ret;
-    lept_member m;
+    if (*c->json != '\"')
+        return LEPT_PARSE_MISS_KEY;
+    if (f->size == c->max_elements)
+        return LEPT_PARSE_TOO_MANY_ELEMENTS;
+    if (f->size < f->shape_size &&
+        lept_parse_key_like(c, like = (const lept_member *)f->shape + f->size)) {
+        k = like->k;
+        len = like->klen;
+    } else {
+        STAT_START(c, start);
+        ret = lept_parse_string_raw(c, &str, &len);
+        STAT_STOP(c, string_ns, start);
+        if (ret != LEPT_PARSE_OK)
+            return ret;
+    }
+    lept_parse_whitespace(c);
+    if (*c->json != ':')
+        return LEPT_PARSE_MISS_COLON;
+    ++c->json;
     lept_parse_whitespace(c);
-    if (*c->json == '}') {
-        ++c->json;
-        v->type = LEPT_OBJECT;
-        v->u.o.size = 0;
-        v->u.o.m = NULL;
+    if (sel != NULL)
+        for (child = sel->child; child != NULL; child = child->next)
+            if (child->klen == len && memcmp(child->k, str, len) == 0)
+                break;
+    /* scalars cannot contain the rest of a selected path */
+    *drop = sel != NULL && (child == NULL || (!child->leaf &&
+                            *c->json != '[' && *c->json != '{'));
+    if (*drop) {
+        c->sel = sel;
         return LEPT_PARSE_OK;
     }
-    m.k = NULL;
-    while (1) {
-        char *str;
-        lept_init(&m.v);
-        if (*c->json != '\"') {
-            ret = LEPT_PARSE_MISS_KEY;
-            break;
+    if (k != NULL) {
+        /* nothing outside this parse sees the key yet */
+        ++BLOCK(k)->refs;
+    } else {
+        if (!lept_parse_fits(c, sizeof(lept_block) + len + 1))
+            return LEPT_PARSE_TOO_MUCH_MEMORY;
+        k = lept_key_new(c->alloc, str, len);
+        c->used += sizeof(lept_block) + len + 1;
+        STAT(c, ++st->allocs; st->alloc_bytes += len + 1);
+    }
+    if ((ret = lept_parse_reserve(c, sizeof(lept_member))) != LEPT_PARSE_OK) {
+        lept_key_release(k, len);
+        return ret;
+    }
+    m = (lept_member *)lept_context_push(c, sizeof(lept_member));
+    m->k = k;
+    m->klen = len;
+    lept_init(&m->v);
+    ++FRAME(c)->size;
+    c->sel = child != NULL && !child->leaf ? child : NULL;
+    return LEPT_PARSE_OK;
+}
+
+/* frees everything pushed by the containers still open after an error */
+static void lept_parse_unwind(lept_context *c) {
+    STAT_PEAK(c);
+    while (c->frame != LEPT_FRAME_NONE) {
+        lept_frame *f = FRAME(c);
+        size_t parent = f->parent;
+        if (f->type == LEPT_ARRAY) {
+            while (c->top > c->frame + sizeof(lept_frame))
+                lept_free((lept_value *)lept_context_pop(c, sizeof(lept_value)));
+        } else {
+            while (c->top > c->frame + sizeof(lept_frame)) {
+                lept_member *m = (lept_member *)lept_context_pop(c, sizeof(lept_member));
+                lept_key_release(m->k, m->klen);
+                lept_free(&m->v);
+            }
         }
-        if ((ret = lept_parse_string_raw(c, &str, &m.klen)) != LEPT_PARSE_OK)
-            break;
-        memcpy(m.k = (char *)malloc(m.klen + 1), str, m.klen);
-        m.k[m.klen] = '\0';
-        lept_parse_whitespace(c);
-        if (*c->json != ':') {
-            ret = LEPT_PARSE_MISS_COLON;
-            break;
+        lept_context_pop(c, sizeof(lept_frame));
+        c->frame = parent;
+        --c->depth;
+    }
+}
+
+/*
+ * Iterative: nesting lives in lept_frame records on the context stack, so
+ * the C stack stays flat however deep the input is.
+ */
+static int lept_parse_value(lept_context *c, lept_value *v) {
+    lept_value e;
+    lept_frame *f;
+    int ret, drop = 0;
+    while (1) {
+        char ch = *c->json;
+        lept_init(&e);
+        if (drop || (c->sel != NULL && ch != '[' && ch != '{')) {
+            ret = lept_parse_skip(c);
+            drop = 1;
+        } else {
+            switch (ch) {
+                case 'n':  ret = lept_parse_literal(c, &e, "null", LEPT_NULL);  break;
+                case 't':  ret = lept_parse_literal(c, &e, "true", LEPT_TRUE);  break;
+                case 'f':  ret = lept_parse_literal(c, &e, "false", LEPT_FALSE); break;
+                case '\"': ret = lept_parse_string(c, &e); break;
+                default:   ret = lept_parse_number(c, &e); break;
+                case '\0': ret = LEPT_PARSE_EXPECT_VALUE; break;
+                case '[':
+                    if ((ret = lept_parse_open(c, LEPT_ARRAY)) != LEPT_PARSE_OK)
+                        break;
+                    if (*c->json == ']') {
+                        ret = lept_parse_close(c, &e);
+                        break;
+                    }
+                    continue;
+                case '{':
+                    if ((ret = lept_parse_open(c, LEPT_OBJECT)) != LEPT_PARSE_OK)
+                        break;
+                    if (*c->json == '}') {
+                        ret = lept_parse_close(c, &e);
+                        break;
+                    }
+                    if ((ret = lept_parse_member(c, &drop)) != LEPT_PARSE_OK)
+                        break;
+                    continue;
+            }
         }
-        ++c->json;
-        lept_parse_whitespace(c);
-        if ((ret = lept_parse_value(c, &m.v)) != LEPT_PARSE_OK)
+        if (ret != LEPT_PARSE_OK)
             break;
-        memcpy(lept_context_push(c, sizeof(lept_member)), &m, sizeof(lept_member));
-        ++size;
-        m.k = NULL;
-        lept_parse_whitespace(c);
-        if (*c->json == ',') {
-            ++c->json;
+        /* a value is complete: store it, then read separators and closers */
+        while (1) {
+            if (c->frame == LEPT_FRAME_NONE) {
+                if (!drop)
+                    memcpy(v, &e, sizeof(lept_value));
+                return LEPT_PARSE_OK;
+            }
+            f = FRAME(c);
+            if (!drop) {
+                if (f->type == LEPT_ARRAY) {
+                    if (f->size == c->max_elements)
+                        ret = LEPT_PARSE_TOO_MANY_ELEMENTS;
+                    else
+                        ret = lept_parse_reserve(c, sizeof(lept_value));
+                    if (ret != LEPT_PARSE_OK) {
+                        lept_free(&e);
+                        break;
+                    }
+                    f = FRAME(c);
+                    ++f->size;
+                    memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
+                } else {
+                    memcpy(&((lept_member *)(c->stack + c->top) - 1)->v, &e,
+                           sizeof(lept_value));
+                }
+            }
+            drop = 0;
             lept_parse_whitespace(c);
-        } else if (*c->json == '}') {
-            ++c->json;
-            v->type = LEPT_OBJECT;
-            v->u.o.size = size;
-            size *= sizeof(lept_member);
-            memcpy(v->u.o.m = (lept_member *)malloc(size),
-                         lept_context_pop(c, size), size);
-            return LEPT_PARSE_OK;
-        } else {
-            ret = LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
-            break;
+            if (*c->json == ',') {
+                ++c->json;
+                lept_parse_whitespace(c);
+                if (f->type == LEPT_ARRAY)
+                    c->sel = f->sel;
+                else
+                    ret = lept_parse_member(c, &drop);
+                break;
+            } else if (*c->json == (f->type == LEPT_ARRAY ? ']' : '}')) {
+                if ((ret = lept_parse_close(c, &e)) != LEPT_PARSE_OK)
+                    break;
+            } else {
+                ret = f->type == LEPT_ARRAY ? LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET
+                                            : LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+                break;
+            }
         }
+        if (ret != LEPT_PARSE_OK)
+            break;
     }
-    free(m.k);
-    for (size_t i = 0; i < size; ++i) {
-        lept_member *free_m = (lept_member *)lept_context_pop(c,
-                                                              sizeof(lept_member));
-        free(free_m->k);
-    }
-    v->type = LEPT_NULL;
+    lept_parse_unwind(c);
     return ret;
 }
 
-static int lept_parse_value(lept_context *c, lept_value *v) {
-    switch (*c->json) {
-        case 'n':  return lept_parse_literal(c, v, "null", LEPT_NULL);
-        case 't':  return lept_parse_literal(c, v, "true", LEPT_TRUE);
-        case 'f':  return lept_parse_literal(c, v, "false", LEPT_FALSE);
-        case '\"': return lept_parse_string(c, v);
-        case '[':  return lept_parse_array(c, v);
-        case '{':  return lept_parse_object(c, v);
-        default:   return lept_parse_number(c, v);
-        case '\0': return LEPT_PARSE_EXPECT_VALUE;
-  }
+/*
+ * Paths are JSON Pointers ("/a/b", with "~0" for '~' and "~1" for '/').
+ * They are merged into one prefix tree whose nodes and unescaped segments
+ * share a single block of lept_paths_size() bytes.
+ */
+static size_t lept_paths_size(const char *const *paths, size_t count, size_t *nodes) {
+    size_t chars = 0;
+    *nodes = 1;
+    for (size_t i = 0; i < count; ++i) {
+        assert(paths[i] != NULL && (paths[i][0] == '\0' || paths[i][0] == '/'));
+        for (const char *p = paths[i]; *p; ++p, ++chars)
+            *nodes += *p == '/';
+    }
+    return *nodes * sizeof(lept_path_node) + chars;
 }
 
-int lept_parse(lept_value *v, const char *json) {
-    lept_context c;
+static lept_path_node *lept_build_paths(void *mem, const char *const *paths,
+                                        size_t count, size_t nodes) {
+    lept_path_node *root = (lept_path_node *)mem;
+    lept_path_node *next_node = root + 1;
+    char *next_char = (char *)(root + nodes);
+    memset(root, 0, sizeof(lept_path_node));
+    for (size_t i = 0; i < count; ++i) {
+        lept_path_node *n = root;
+        const char *p = paths[i];
+        while (*p == '/' && !n->leaf) {
+            char *k = next_char;
+            lept_path_node *child;
+            for (++p; *p && *p != '/'; ++p) {
+                if (p[0] == '~' && (p[1] == '0' || p[1] == '1'))
+                    *next_char++ = *++p == '0' ? '~' : '/';
+                else
+                    *next_char++ = *p;
+            }
+            for (child = n->child; child != NULL; child = child->next)
+                if (child->klen == (size_t)(next_char - k) &&
+                    memcmp(child->k, k, child->klen) == 0)
+                    break;
+            if (child == NULL) {
+                child = next_node++;
+                child->k = k;
+                child->klen = next_char - k;
+                child->child = NULL;
+                child->next = n->child;
+                child->leaf = 0;
+                n->child = child;
+            }
+            n = child;
+        }
+        n->leaf = 1;
+    }
+    return root;
+}
+
+/*
+ * Whether a document that failed to parse could still be completed by input
+ * following `end`, i.e. it only broke down where the input ran out. One that
+ * is invalid right up to the end passes as well, until more input shows it.
+ */
+static int lept_parse_truncated(const char *json, const char *end, unsigned flags,
+                                size_t max_depth) {
+    const char *p = json, *q;
+    int ret = lept_skip_value(&p, end, flags, max_depth);
+    if (ret == LEPT_PARSE_OK || p == end)
+        return ret != LEPT_PARSE_OK;
+    switch (ret) {
+        case LEPT_PARSE_INVALID_UNICODE_HEX:
+        case LEPT_PARSE_INVALID_UNICODE_SURROGATE:
+            /* \u escapes cut short */
+            for (; p < end; ++p)
+                if (!ISDIGIT(*p) && !(*p >= 'a' && *p <= 'f') && !(*p >= 'A' && *p <= 'F') &&
+                    *p != '\\' && *p != 'u')
+                    return 0;
+            return 1;
+        case LEPT_PARSE_INVALID_UTF8:
+            /* p is at the run of plain characters holding the error */
+            for (q = p; q < end && ISPLAIN(*q); ++q)
+                ;
+            if (q != end)
+                return 0;
+            while (q > p && q > end - 3 && ((unsigned char)q[-1] & 0xC0) == 0x80)
+                --q;
+            if (q == p || (unsigned char)q[-1] < 0xC0 ||
+                end - q + 1 >= ((unsigned char)q[-1] < 0xE0 ? 2 : (unsigned char)q[-1] < 0xF0 ? 3 : 4))
+                return 0;
+            return lept_utf8_valid(p, (size_t)(q - 1 - p));
+    }
+    return 0;
+}
+
+/*
+ * Parses with a stack the caller set up in c and hands back. `paths` is
+ * scratch memory for the projection of opt, if any. With `end`, json is the
+ * next document in a stream that so far runs up to end.
+ */
+static int lept_parse_in(lept_context *c, lept_value *v, const char *json, const char *end,
+                         const lept_parse_options *opt, void *paths, size_t nodes) {
     int ret;
-    assert(v != NULL);
-    c.json = json;
-    c.stack = NULL;
-    c.size = c.top = 0;
+    c->json = json;
+    c->end = NULL;
+    c->sel = NULL;
+    c->flags = opt != NULL ? opt->flags : 0;
+    c->top = 0;
+    c->frame = LEPT_FRAME_NONE;
+    c->depth = 0;
+    c->max_depth = opt != NULL && opt->max_depth ? opt->max_depth : LEPT_PARSE_MAX_DEPTH;
+    c->grown = 0;
+    c->used = 0;
+    c->max_bytes = opt != NULL && opt->max_bytes ? opt->max_bytes : (size_t)-1;
+    c->max_string_length = opt != NULL && opt->max_string_length ? opt->max_string_length
+                                                                 : (size_t)-1;
+    c->max_elements = opt != NULL && opt->max_elements ? opt->max_elements : (size_t)-1;
+    c->stats = opt != NULL ? opt->stats : NULL;
+    c->alloc = opt != NULL && opt->allocator != NULL ? opt->allocator : &lept_std_allocator;
+    if (c->stats != NULL)
+        memset(c->stats, 0, sizeof(lept_stats));
+    STAT_START(c, start);
+    if (opt != NULL && opt->paths != NULL) {
+        lept_path_node *root = lept_build_paths(paths, opt->paths, opt->path_count, nodes);
+        c->end = end != NULL ? end : json + strlen(json);
+        c->sel = root->leaf ? NULL : root;
+    }
     lept_init(v);
-    lept_parse_whitespace(&c);
-    if ((ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK) {
-        lept_parse_whitespace(&c);
-        if (*c.json != '\0') {
-            v->type = LEPT_NULL;
-            return LEPT_PARSE_ROOT_NOT_SINGULAR;
+    lept_parse_whitespace(c);
+    ret = lept_parse_value(c, v);
+    if (end == NULL) {
+        if (ret == LEPT_PARSE_OK) {
+            lept_parse_whitespace(c);
+            if (*c->json != '\0') {
+                lept_free(v);
+                ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+            }
+        }
+    } else if (!(c->flags & LEPT_PARSE_STREAM_END)) {
+        /* a number running into the end may go on in the next chunk; limits stay */
+        if (ret == LEPT_PARSE_OK ? v->type == LEPT_NUMBER && c->json == end
+                                 : ret < LEPT_PARSE_NESTING_TOO_DEEP &&
+                                   lept_parse_truncated(json, end, c->flags, c->max_depth)) {
+            if (ret == LEPT_PARSE_OK)
+                lept_free(v);
+            ret = LEPT_PARSE_INCOMPLETE;
+        }
+    }
+    STAT(c, st->structure_ns = lept_now_ns() - start - st->string_ns - st->number_ns;
+            st->bytes = c->json - json;
+            if (ret == LEPT_PARSE_OK) lept_stats_tree(st, v, 1));
+    assert(c->top == 0);
+    return ret;
+}
+
+int lept_parse_ex(lept_value *v, const char *json, const lept_parse_options *opt) {
+    lept_context c;
+    void *paths = NULL;
+    size_t nodes = 0;
+    int ret;
+    assert(v != NULL && json != NULL);
+    c.stack = NULL;
+    c.size = 0;
+    c.borrowed = 0;
+    c.stack_alloc = opt != NULL && opt->allocator != NULL ? opt->allocator : &lept_std_allocator;
+    if (opt != NULL && opt->paths != NULL)
+        paths = malloc(lept_paths_size(opt->paths, opt->path_count, &nodes));
+    ret = lept_parse_in(&c, v, json, NULL, opt, paths, nodes);
+    lept_context_free(&c);
+    free(paths);
+    return ret;
+}
+
+struct lept_parser {
+    const lept_allocator *alloc;
+    char *stack;
+    size_t size;
+    void *paths;
+    size_t paths_size;
+    size_t max_retained;
+};
+
+lept_parser *lept_parser_create(const lept_allocator *a, size_t max_retained) {
+    lept_parser *p;
+    if (a == NULL)
+        a = &lept_std_allocator;
+    p = (lept_parser *)lept_malloc(a, sizeof(lept_parser));
+    p->alloc = a;
+    p->stack = NULL;
+    p->size = 0;
+    p->paths = NULL;
+    p->paths_size = 0;
+    p->max_retained = max_retained;
+    return p;
+}
+
+/* gives back whatever is beyond the retention cap */
+static void lept_parser_trim(lept_parser *p, size_t max_retained) {
+    if (p->stack != NULL && p->size + p->paths_size > max_retained) {
+        lept_release(p->alloc, p->stack, p->size);
+        p->stack = NULL;
+        p->size = 0;
+    }
+    if (p->paths != NULL && p->size + p->paths_size > max_retained) {
+        lept_release(p->alloc, p->paths, p->paths_size);
+        p->paths = NULL;
+        p->paths_size = 0;
+    }
+}
+
+void lept_parser_destroy(lept_parser *p) {
+    if (p == NULL)
+        return;
+    lept_parser_trim(p, 0);
+    lept_release(p->alloc, p, sizeof(lept_parser));
+}
+
+static int lept_parser_run(lept_parser *p, lept_value *v, const char *json, const char **end,
+                           const lept_parse_options *opt) {
+    lept_context c;
+    size_t nodes = 0;
+    int ret;
+    if (opt != NULL && opt->paths != NULL) {
+        size_t size = lept_paths_size(opt->paths, opt->path_count, &nodes);
+        if (size > p->paths_size) {
+            if (p->paths != NULL)
+                lept_release(p->alloc, p->paths, p->paths_size);
+            p->paths = lept_malloc(p->alloc, size);
+            p->paths_size = size;
         }
     }
-    assert(c.top == 0);
-    free(c.stack);
+    c.stack = p->stack;
+    c.size = p->size;
+    c.borrowed = 0;
+    c.stack_alloc = p->alloc;
+    ret = lept_parse_in(&c, v, json, end != NULL ? *end : NULL, opt, p->paths, nodes);
+    p->stack = c.stack;
+    p->size = c.size;
+    lept_parser_trim(p, p->max_retained);
+    if (end != NULL)
+        *end = c.json;
     return ret;
 }
 
+int lept_parser_parse(lept_parser *p, lept_value *v, const char *json,
+                      const lept_parse_options *opt) {
+    assert(p != NULL && v != NULL && json != NULL);
+    return lept_parser_run(p, v, json, NULL, opt);
+}
+
+int lept_parser_next(lept_parser *p, lept_value *v, const char *json, size_t len,
+                     size_t *offset, const lept_parse_options *opt) {
+    const char *start, *end = json + len;
+    int ret;
+    assert(p != NULL && v != NULL && json != NULL && offset != NULL);
+    assert(*offset <= len && json[len] == '\0');
+    start = json + *offset;
+    lept_skip_whitespace(&start, end);
+    *offset = start - json;
+    if (start == end) {
+        lept_init(v);
+        return opt != NULL && (opt->flags & LEPT_PARSE_STREAM_END) ? LEPT_PARSE_EXPECT_VALUE
+                                                                   : LEPT_PARSE_INCOMPLETE;
+    }
+    if ((ret = lept_parser_run(p, v, start, &end, opt)) == LEPT_PARSE_OK)
+        *offset = end - json;
+    return ret;
+}
+
+int lept_parse(lept_value *v, const char *json) {
+    return lept_parse_ex(v, json, NULL);
+}
+
+int lept_parse_projection(lept_value *v, const char *json,
+                          const char *const *paths, size_t count) {
+    lept_parse_options opt;
+    assert(paths != NULL);
+    memset(&opt, 0, sizeof(opt));
+    opt.paths = paths;
+    opt.path_count = count;
+    return lept_parse_ex(v, json, &opt);
+}
+
 lept_type lept_get_type(const lept_value *v) {
     assert(v != NULL);
     return v->type;
@@ -403,12 +2038,69 @@ size_t lept_get_array_size(const lept_value *v) {
     return v->u.a.size;
 }
 
+/* element i of a packed array as a value of its own */
+static void lept_packed_element(const lept_value *v, size_t i, lept_value *e) {
+    e->type = LEPT_NUMBER;
+    e->hash = 0;
+    if (v->flags & LEPT_VALUE_INT64) {
+        e->flags = LEPT_VALUE_INT64;
+        e->u.i64 = ((const int64_t *)v->u.a.e)[i];
+    } else {
+        e->flags = 0;
+        e->u.n = ((const double *)v->u.a.e)[i];
+    }
+}
+
+/* turns a packed array back into lept_value elements, in place */
+static void lept_unpack(lept_value *v) {
+    lept_value old = *v;
+    size_t i, n = v->u.a.size;
+    lept_value *e = (lept_value *)lept_value_alloc(v, lept_value_allocator(&old),
+                                                   n * sizeof(lept_value));
+    for (i = 0; i < n; ++i)
+        lept_packed_element(&old, i, &e[i]);
+    v->u.a.e = e;
+    lept_value_release(&old, old.u.a.e, n * PACKED_SIZE);
+}
+
 lept_value *lept_get_array_element(const lept_value *v, size_t index) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
+    assert(v != NULL && v->type == LEPT_ARRAY && !(v->flags & LEPT_VALUE_PACKED));
     assert(index < v->u.a.size);
     return v->u.a.e + index;
 }
 
+const lept_value *lept_peek_array_element(const lept_value *v, size_t index, lept_value *buffer) {
+    assert(v != NULL && v->type == LEPT_ARRAY && buffer != NULL);
+    assert(index < v->u.a.size);
+    if (!(v->flags & LEPT_VALUE_PACKED))
+        return v->u.a.e + index;
+    lept_packed_element(v, index, buffer);
+    return buffer;
+}
+
+void lept_unpack_array(lept_value *v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    if (v->flags & LEPT_VALUE_PACKED)
+        lept_unpack(v);
+}
+
+const double *lept_get_array_doubles(const lept_value *v, size_t *size) {
+    assert(v != NULL && v->type == LEPT_ARRAY && size != NULL);
+    if ((v->flags & (LEPT_VALUE_PACKED | LEPT_VALUE_INT64)) != LEPT_VALUE_PACKED)
+        return NULL;
+    *size = v->u.a.size;
+    return (const double *)v->u.a.e;
+}
+
+const int64_t *lept_get_array_int64s(const lept_value *v, size_t *size) {
+    assert(v != NULL && v->type == LEPT_ARRAY && size != NULL);
+    if ((v->flags & (LEPT_VALUE_PACKED | LEPT_VALUE_INT64)) !=
+        (LEPT_VALUE_PACKED | LEPT_VALUE_INT64))
+        return NULL;
+    *size = v->u.a.size;
+    return (const int64_t *)v->u.a.e;
+}
+
 size_t lept_get_object_size(const lept_value *v) {
     assert(v != NULL);
     return v->u.o.size;
@@ -433,7 +2125,20 @@ lept_value *lept_get_object_value(const lept_value *v, size_t index) {
 #define LEPT_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
 
-#define PUTS(c, s, len) memcpy(lept_context_push(c, len), s, len)
+
+/* of str quoted and escaped as lept_stringify_string writes it */
+static size_t lept_string_length(const char *str, size_t len) {
+    size_t size = len + 2;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = str[i];
+        if (ch == '\"' || ch == '\\' || ch == '\b' || ch == '\f' || ch == '\n' ||
+            ch == '\r' || ch == '\t')
+            size += 1;
+        else if (ch < 0x20)
+            size += 5;
+    }
+    return size;
+}
 
 # if 0
 
@@ -468,8 +2173,10 @@ static int lept_stringify_string(lept_context *c, const char *str, size_t len) {
 // optimized
 static int lept_stringify_string(lept_context *c, const char *str, size_t len) {
     assert(str != NULL);
-    size_t size;
-    char *p = lept_context_push(c, size = len * 6 + 2);
+    /* the worst case unless that would outgrow a borrowed stack, then exactly */
+    size_t size = !c->borrowed || c->top + len * 6 + 2 <= c->size ? len * 6 + 2
+                                                                   : lept_string_length(str, len);
+    char *p = lept_context_push(c, size);
     char *head = p;
     *p++ = '\"';
     for (size_t i = 0; i < len; ++i) {
@@ -500,60 +2207,551 @@ static int lept_stringify_string(lept_context *c, const char *str, size_t len) {
 
 #endif
 
-static int lept_stringify_value(lept_context *c, const lept_value *v) {
+typedef struct {
+    const lept_value *v;
+    size_t i;
+} lept_stringify_frame;
+
+static const char lept_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* writes an integer two digits at a time, returns the length */
+static size_t lept_utoa(char *buf, int neg, uint64_t n) {
+    char tmp[20], *p = tmp + sizeof(tmp);
+    size_t len = 0;
+    if (neg)
+        buf[len++] = '-';
+    while (n >= 100) {
+        const char *d = lept_digit_pairs + (n % 100) * 2;
+        n /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (n >= 10) {
+        *--p = lept_digit_pairs[n * 2 + 1];
+        *--p = lept_digit_pairs[n * 2];
+    } else {
+        *--p = (char)('0' + n);
+    }
+    memcpy(buf + len, p, (size_t)(tmp + sizeof(tmp) - p));
+    return len + (size_t)(tmp + sizeof(tmp) - p);
+}
+
+static size_t lept_itoa(char *buf, int64_t n) {
+    return n < 0 ? lept_utoa(buf, 1, 0 - (uint64_t)n) : lept_utoa(buf, 0, (uint64_t)n);
+}
+
+/* at most 32 bytes, for numbers other than lazy ones */
+static inline size_t lept_format_number(char *buf, const lept_value *v) {
+    if (v->flags & LEPT_VALUE_INT64)
+        return lept_itoa(buf, v->u.i64);
+    if (v->flags & LEPT_VALUE_UINT64)
+        return lept_utoa(buf, 0, v->u.u64);
+    return (size_t)sprintf(buf, "%.17g", v->u.n);
+}
+
+static inline void lept_stringify_scalar(lept_context *c, const lept_value *v) {
     switch (v->type) {
         case LEPT_NULL : PUTS(c, "null",  4); break;
         case LEPT_TRUE : PUTS(c, "true",  4); break;
         case LEPT_FALSE: PUTS(c, "false", 5); break;
-        case LEPT_NUMBER:
-            c->top -= 32 - sprintf(lept_context_push(c, 32), "%.17g", v->u.n);
+        case LEPT_NUMBER: {
+            STAT_START(c, start);
+            if (v->flags & LEPT_VALUE_RAW) {
+                PUTS(c, v->u.r.p, lept_number_length(v->u.r.p));
+            } else {
+                /* a borrowed stack is not given up for the slack */
+                char scratch[32], *p = c->borrowed && c->top + 32 > c->size
+                                           ? scratch : (char *)lept_context_push(c, 32);
+                size_t len = lept_format_number(p, v);
+                if (p == scratch)
+                    PUTS(c, scratch, len);
+                else
+                    c->top -= 32 - len;
+            }
+            STAT_STOP(c, number_ns, start);
             break;
-        case LEPT_STRING:
+        }
+        case LEPT_STRING: {
+            STAT_START(c, start);
             lept_stringify_string(c, v->u.s.s, v->u.s.len);
+            STAT_STOP(c, string_ns, start);
             break;
-        case LEPT_ARRAY:
+        }
+        case LEPT_ARRAY: {
+            /* only packed ones come here */
+            STAT_START(c, start);
+            size_t i;
             PUTC(c, '[');
-            for (size_t i = 0; i < v->u.a.size; ++i) {
-                if (i > 0) PUTC(c, ',');
-                lept_stringify_value(c, v->u.a.e + i);
+            for (i = 0; i < v->u.a.size; ++i) {
+                char scratch[33], *p = scratch;
+                if (i > 0)
+                    *p++ = ',';
+                if (v->flags & LEPT_VALUE_INT64)
+                    p += lept_itoa(p, ((const int64_t *)v->u.a.e)[i]);
+                else
+                    p += sprintf(p, "%.17g", ((const double *)v->u.a.e)[i]);
+                PUTS(c, scratch, (size_t)(p - scratch));
             }
             PUTC(c, ']');
+            STAT_STOP(c, number_ns, start);
             break;
-        case LEPT_OBJECT:
-            PUTC(c, '{');
-            for (size_t i = 0; i < v->u.o.size; ++i) {
-                if (i > 0) PUTC(c, ',');
-                lept_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
-                PUTC(c, ':');
-                lept_stringify_value(c, &v->u.o.m[i].v);
+        }
+        default: break;
+    }
+}
+
+/* the ',' and key that go before child f->i of an array or object */
+static inline void lept_stringify_separator(lept_context *c, const lept_stringify_frame *f) {
+    if (f->i > 0) PUTC(c, ',');
+    if (f->v->type == LEPT_OBJECT) {
+        STAT_START(c, start);
+        lept_stringify_string(c, f->v->u.o.m[f->i].k, f->v->u.o.m[f->i].klen);
+        STAT_STOP(c, string_ns, start);
+        PUTC(c, ':');
+    }
+}
+
+static int lept_stringify_value(lept_context *c, const lept_value *v) {
+    lept_stringify_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    WALK_INIT(walk, local);
+    while (1) {
+        if (ISCONTAINER(v)) {
+            PUTC(c, v->type == LEPT_ARRAY ? '[' : '{');
+            f = (lept_stringify_frame *)lept_context_push(&walk, sizeof(lept_stringify_frame));
+            f->v = v;
+            f->i = 0;
+        } else {
+            lept_stringify_scalar(c, v);
+        }
+        /* find the next value to write, closing finished containers */
+        v = NULL;
+        while (walk.top > 0) {
+            f = WALK_TOP(walk, lept_stringify_frame);
+            if (f->i == CHILDREN(f->v)) {
+                PUTC(c, f->v->type == LEPT_ARRAY ? ']' : '}');
+                lept_context_pop(&walk, sizeof(lept_stringify_frame));
+                continue;
             }
-            PUTC(c, '}');
+            lept_stringify_separator(c, f);
+            v = CHILD(f->v, f->i);
+            ++f->i;
+            break;
+        }
+        if (v == NULL)
             break;
-        default: break;
     }
+    WALK_FREE(walk);
     return LEPT_STRINGIFY_OK;
 }
 
-int lept_stringify(const lept_value *v, char **json, size_t *length) {
+typedef struct lept_serializer_node lept_serializer_node;
+
+static int lept_stringify_cached(lept_context *c, const lept_value *v,
+                                 lept_serializer_node **tree, const char *old);
+
+/*
+ * writes v and a '\0' to the stack the caller set up in c, splicing in the
+ * text of `old` its `tree` still has for unchanged containers if not NULL
+ */
+static int lept_stringify_in(lept_context *c, const lept_value *v, size_t *length,
+                             const lept_stringify_options *opt,
+                             lept_serializer_node **tree, const char *old) {
+    int ret;
+    c->top = 0;
+    c->stats = opt != NULL ? opt->stats : NULL;
+    if (c->stats != NULL)
+        memset(c->stats, 0, sizeof(lept_stats));
+    STAT_START(c, start);
+    ret = tree != NULL ? lept_stringify_cached(c, v, tree, old) : lept_stringify_value(c, v);
+    if (ret != LEPT_STRINGIFY_OK)
+        return ret;
+    if (length)
+        *length = c->top;
+    STAT(c, st->bytes = c->top);
+    PUTC(c, '\0');
+    STAT_PEAK(c);
+    STAT(c, st->structure_ns = lept_now_ns() - start - st->string_ns - st->number_ns;
+            lept_stats_tree(st, v, 0));
+    return LEPT_STRINGIFY_OK;
+}
+
+int lept_stringify_ex(const lept_value *v, char **json, size_t *length,
+                      const lept_stringify_options *opt) {
     lept_context c;
     int ret;
     assert(v != NULL);
     assert(json != NULL);
-    c.stack = (char *)malloc(sizeof(char) * LEPT_PARSE_STRINGIFY_INIT_SIZE);
+    c.stack_alloc = opt != NULL && opt->allocator != NULL ? opt->allocator : &lept_std_allocator;
+    c.stack = (char *)lept_malloc(c.stack_alloc, sizeof(char) * LEPT_PARSE_STRINGIFY_INIT_SIZE);
     c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE;
-    c.top = 0;
-    if ((ret = lept_stringify_value(&c, v)) != LEPT_STRINGIFY_OK) {
-        free(c.stack);
+    c.borrowed = 0;
+    if ((ret = lept_stringify_in(&c, v, length, opt, NULL, NULL)) != LEPT_STRINGIFY_OK) {
+        lept_context_free(&c);
         *json = NULL;
         return ret;
     }
-    if (length)
-        *length = c.top;
-    PUTC(&c, '\0');
+    /* a caller-supplied allocator gets back a block of a size it can name */
+    if (c.stack_alloc != &lept_std_allocator && c.top < c.size) {
+        c.stack = (char *)c.stack_alloc->realloc(c.stack_alloc->user, c.stack, c.size, c.top);
+        c.size = c.top;
+    }
     *json = c.stack;
+    STAT(&c, st->allocs = 1; st->alloc_bytes = c.size);
     return LEPT_STRINGIFY_OK;
 }
 
+int lept_stringify_buffer(const lept_value *v, char *buffer, size_t size, size_t *length,
+                          const lept_stringify_options *opt) {
+    lept_context c;
+    size_t len;
+    int ret;
+    assert(v != NULL);
+    assert(buffer != NULL || size == 0);
+    /* the buffer is the stack, given up only once the output outgrows it */
+    c.stack_alloc = opt != NULL && opt->allocator != NULL ? opt->allocator : &lept_std_allocator;
+    c.stack = buffer;
+    c.size = size;
+    c.borrowed = 1;
+    if ((ret = lept_stringify_in(&c, v, &len, opt, NULL, NULL)) != LEPT_STRINGIFY_OK) {
+        lept_context_free(&c);
+        return ret;
+    }
+    if (length)
+        *length = len;
+    if (c.stack == buffer)
+        return LEPT_STRINGIFY_OK;
+    if (size > 0) {
+        memcpy(buffer, c.stack, size - 1);
+        buffer[size - 1] = '\0';
+    }
+    lept_context_free(&c);
+    return LEPT_STRINGIFY_BUFFER_TOO_SMALL;
+}
+
+/* the bytes lept_stringify_scalar writes for v */
+static size_t lept_scalar_length(const lept_value *v) {
+    char buf[32];
+    size_t i, length;
+    switch (v->type) {
+        case LEPT_NULL:
+        case LEPT_TRUE:   return 4;
+        case LEPT_FALSE:  return 5;
+        case LEPT_STRING: return lept_string_length(v->u.s.s, v->u.s.len);
+        case LEPT_NUMBER:
+            if (v->flags & LEPT_VALUE_RAW)
+                return lept_number_length(v->u.r.p);
+            return lept_format_number(buf, v);
+        case LEPT_ARRAY:
+            /* packed */
+            length = v->u.a.size > 0 ? v->u.a.size + 1 : 2;
+            for (i = 0; i < v->u.a.size; ++i)
+                length += v->flags & LEPT_VALUE_INT64
+                              ? lept_itoa(buf, ((const int64_t *)v->u.a.e)[i])
+                              : (size_t)sprintf(buf, "%.17g", ((const double *)v->u.a.e)[i]);
+            return length;
+        default:
+            return 0;
+    }
+}
+
+size_t lept_stringify_length(const lept_value *v) {
+    lept_stringify_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    size_t length = 0, i, n;
+    assert(v != NULL);
+    WALK_INIT(walk, local);
+    while (1) {
+        if (ISCONTAINER(v)) {
+            /* brackets and commas, then keys and colons */
+            n = CHILDREN(v);
+            length += n > 0 ? n + 1 : 2;
+            if (v->type == LEPT_OBJECT)
+                for (i = 0; i < n; ++i)
+                    length += lept_string_length(v->u.o.m[i].k, v->u.o.m[i].klen) + 1;
+            f = (lept_stringify_frame *)lept_context_push(&walk, sizeof(lept_stringify_frame));
+            f->v = v;
+            f->i = 0;
+        } else {
+            length += lept_scalar_length(v);
+        }
+        v = NULL;
+        while (walk.top > 0) {
+            f = WALK_TOP(walk, lept_stringify_frame);
+            if (f->i == CHILDREN(f->v)) {
+                lept_context_pop(&walk, sizeof(lept_stringify_frame));
+                continue;
+            }
+            v = CHILD(f->v, f->i);
+            ++f->i;
+            break;
+        }
+        if (v == NULL)
+            break;
+    }
+    WALK_FREE(walk);
+    return length;
+}
+
+struct lept_serializer {
+    const lept_allocator *alloc;
+    char *buffer;
+    size_t size;
+    size_t max_retained;
+    /* incremental mode: the last output is `buffer`, the next one goes to `spare` */
+    int incremental;
+    const lept_value *root;
+    const void *body;   /* of root when its tree was made */
+    lept_type type;
+    lept_serializer_node *tree;
+    char *spare;
+    size_t spare_size;
+};
+
+/*
+ * Where an array or object is in the last output of an incremental
+ * serializer, with the same for its children that are arrays or objects
+ * (NULL for the others and for those to write again in full). Offsets are
+ * from the start of the parent's text, so a subtree copied elsewhere keeps
+ * its nodes as they are. `dirty` is set on the way to a touched value:
+ * the node is written again, but its other children are copied.
+ */
+struct lept_serializer_node {
+    size_t off, len;
+    size_t n;
+    int dirty;
+    lept_serializer_node *child[];
+};
+
+typedef struct {
+    lept_serializer_node *n;
+    size_t i;
+} lept_node_frame;
+
+#define NODE_SIZE(n) (sizeof(lept_serializer_node) + (n) * sizeof(lept_serializer_node *))
+
+static lept_serializer_node *lept_node_new(const lept_allocator *a, size_t n) {
+    lept_serializer_node *node = (lept_serializer_node *)lept_malloc(a, NODE_SIZE(n));
+    node->off = node->len = 0;
+    node->n = n;
+    node->dirty = 0;
+    memset(node->child, 0, n * sizeof(lept_serializer_node *));
+    return node;
+}
+
+static void lept_node_free(const lept_allocator *a, lept_serializer_node *node) {
+    lept_node_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    if (node == NULL)
+        return;
+    WALK_INIT(walk, local);
+    f = (lept_node_frame *)lept_context_push(&walk, sizeof(lept_node_frame));
+    f->n = node;
+    f->i = 0;
+    while (walk.top > 0) {
+        f = WALK_TOP(walk, lept_node_frame);
+        if (f->i == f->n->n) {
+            lept_release(a, f->n, NODE_SIZE(f->n->n));
+            lept_context_pop(&walk, sizeof(lept_node_frame));
+        } else if ((node = f->n->child[f->i++]) != NULL) {
+            f = (lept_node_frame *)lept_context_push(&walk, sizeof(lept_node_frame));
+            f->n = node;
+            f->i = 0;
+        }
+    }
+    WALK_FREE(walk);
+}
+
+typedef struct {
+    lept_stringify_frame s;
+    lept_serializer_node *node;
+    const char *old;    /* its text in the last output, NULL if written in full */
+    size_t start;       /* of its text in this output */
+} lept_cached_frame;
+
+/*
+ * lept_stringify_value, but an array or object with a clean node is copied
+ * from the last output, and nodes are made or updated for all the others.
+ */
+static int lept_stringify_cached(lept_context *c, const lept_value *v,
+                                 lept_serializer_node **tree, const char *old) {
+    lept_cached_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    lept_serializer_node **slot = tree;
+    size_t start = 0;   /* of the parent of v */
+    WALK_INIT(walk, local);
+    while (1) {
+        lept_serializer_node *node = *slot;
+        if (!ISCONTAINER(v)) {
+            lept_stringify_scalar(c, v);
+            if (node != NULL) {
+                lept_node_free(c->stack_alloc, node);
+                *slot = NULL;
+            }
+        } else {
+            /* a node left from a different value is of no use */
+            if (node != NULL && node->n != CHILDREN(v)) {
+                lept_node_free(c->stack_alloc, node);
+                node = *slot = NULL;
+            }
+            if (node != NULL && !node->dirty) {
+                memcpy(lept_context_push(c, node->len), old + node->off, node->len);
+                node->off = c->top - node->len - start;
+            } else {
+                f = (lept_cached_frame *)lept_context_push(&walk, sizeof(lept_cached_frame));
+                f->s.v = v;
+                f->s.i = 0;
+                if (node == NULL) {
+                    f->old = NULL;
+                    node = *slot = lept_node_new(c->stack_alloc, CHILDREN(v));
+                } else {
+                    f->old = old + node->off;
+                    node->dirty = 0;
+                }
+                f->node = node;
+                f->start = c->top;
+                node->off = c->top - start;
+                PUTC(c, v->type == LEPT_ARRAY ? '[' : '{');
+            }
+        }
+        /* find the next value to write, closing finished containers */
+        v = NULL;
+        while (walk.top > 0) {
+            f = WALK_TOP(walk, lept_cached_frame);
+            if (f->s.i == CHILDREN(f->s.v)) {
+                PUTC(c, f->s.v->type == LEPT_ARRAY ? ']' : '}');
+                f->node->len = c->top - f->start;
+                lept_context_pop(&walk, sizeof(lept_cached_frame));
+                continue;
+            }
+            lept_stringify_separator(c, &f->s);
+            v = CHILD(f->s.v, f->s.i);
+            slot = &f->node->child[f->s.i];
+            old = f->old;
+            start = f->start;
+            ++f->s.i;
+            break;
+        }
+        if (v == NULL)
+            break;
+    }
+    WALK_FREE(walk);
+    return LEPT_STRINGIFY_OK;
+}
+
+lept_serializer *lept_serializer_create(const lept_allocator *a, size_t max_retained) {
+    lept_serializer *s;
+    if (a == NULL)
+        a = &lept_std_allocator;
+    s = (lept_serializer *)lept_malloc(a, sizeof(lept_serializer));
+    s->alloc = a;
+    s->buffer = NULL;
+    s->size = 0;
+    s->max_retained = max_retained;
+    s->incremental = 0;
+    s->root = NULL;
+    s->body = NULL;
+    s->type = LEPT_NULL;
+    s->tree = NULL;
+    s->spare = NULL;
+    s->spare_size = 0;
+    return s;
+}
+
+void lept_serializer_set_incremental(lept_serializer *s, int on) {
+    assert(s != NULL);
+    s->incremental = on != 0;
+    s->root = NULL;
+    lept_node_free(s->alloc, s->tree);
+    s->tree = NULL;
+}
+
+void lept_serializer_destroy(lept_serializer *s) {
+    if (s == NULL)
+        return;
+    if (s->buffer != NULL)
+        lept_release(s->alloc, s->buffer, s->size);
+    if (s->spare != NULL)
+        lept_release(s->alloc, s->spare, s->spare_size);
+    lept_node_free(s->alloc, s->tree);
+    lept_release(s->alloc, s, sizeof(lept_serializer));
+}
+
+static int lept_serializer_write_incremental(lept_serializer *s, const lept_value *v,
+                                             const char **json, size_t *length,
+                                             const lept_stringify_options *opt) {
+    lept_context c;
+    char *old;
+    size_t old_size;
+    int ret;
+    /* the tree only holds for the value it was made from, not a new one at the same address */
+    if (v != s->root || !(v->flags & LEPT_VALUE_SERIALIZED) || v->type != s->type ||
+        lept_value_body(v) != s->body) {
+        lept_node_free(s->alloc, s->tree);
+        s->tree = NULL;
+        s->root = v;
+        s->body = lept_value_body(v);
+        s->type = v->type;
+        if (ISCONTAINER(v))
+            ((lept_value *)v)->flags |= LEPT_VALUE_SERIALIZED;
+    }
+    /* the last output is read while writing this one, so only the spare can go */
+    if (s->spare != NULL && s->spare_size > s->max_retained) {
+        lept_release(s->alloc, s->spare, s->spare_size);
+        s->spare = NULL;
+        s->spare_size = 0;
+    }
+    c.stack = s->spare;
+    c.size = s->spare_size;
+    c.borrowed = 0;
+    c.stack_alloc = s->alloc;
+    ret = lept_stringify_in(&c, v, length, opt, &s->tree, s->buffer);
+    old = s->buffer;
+    old_size = s->size;
+    s->buffer = c.stack;
+    s->size = c.size;
+    s->spare = old;
+    s->spare_size = old_size;
+    if (ret != LEPT_STRINGIFY_OK) {
+        s->root = NULL;
+        lept_node_free(s->alloc, s->tree);
+        s->tree = NULL;
+    }
+    *json = ret == LEPT_STRINGIFY_OK ? c.stack : NULL;
+    return ret;
+}
+
+int lept_serializer_write(lept_serializer *s, const lept_value *v, const char **json,
+                          size_t *length, const lept_stringify_options *opt) {
+    lept_context c;
+    int ret;
+    assert(s != NULL && v != NULL && json != NULL);
+    if (s->incremental)
+        return lept_serializer_write_incremental(s, v, json, length, opt);
+    /* the last output was still readable until now */
+    if (s->buffer != NULL && s->size > s->max_retained) {
+        lept_release(s->alloc, s->buffer, s->size);
+        s->buffer = NULL;
+        s->size = 0;
+    }
+    c.stack = s->buffer;
+    c.size = s->size;
+    c.borrowed = 0;
+    c.stack_alloc = s->alloc;
+    ret = lept_stringify_in(&c, v, length, opt, NULL, NULL);
+    s->buffer = c.stack;
+    s->size = c.size;
+    *json = ret == LEPT_STRINGIFY_OK ? c.stack : NULL;
+    return ret;
+}
+
+int lept_stringify(const lept_value *v, char **json, size_t *length) {
+    return lept_stringify_ex(v, json, length, NULL);
+}
+
 #define LEPT_KEY_NOT_EXIST ((size_t)-1)
 
 size_t lept_find_object_index(const lept_value *v, const char *key, size_t klen) {
@@ -564,13 +2762,75 @@ size_t lept_find_object_index(const lept_value *v, const char *key, size_t klen)
     return LEPT_KEY_NOT_EXIST;
 }
 
+size_t lept_find_object_index_hint(const lept_value *v, const char *key, size_t klen,
+                                   size_t *hint) {
+    size_t i;
+    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL && hint != NULL);
+    i = *hint;
+    if (i < v->u.o.size && v->u.o.m[i].klen == klen &&
+        (v->u.o.m[i].k == key || memcmp(v->u.o.m[i].k, key, klen) == 0))
+        return i;
+    if ((i = lept_find_object_index(v, key, klen)) != LEPT_KEY_NOT_EXIST)
+        *hint = i;
+    return i;
+}
+
 lept_value *lept_find_object_value(lept_value *v, const char *key, size_t klen) {
     size_t index = lept_find_object_index(v, key, klen);
     return index != LEPT_KEY_NOT_EXIST ? &v->u.o.m[index].v : NULL;
 }
 
-int lept_is_equal(const lept_value *lhs, const lept_value *rhs) {
-    assert(lhs != NULL && rhs != NULL);
+/* true when both values have cached hashes and these differ, see lept_hash_clear */
+static int lept_hash_differ(const lept_value *lhs, const lept_value *rhs) {
+    uint32_t l = LEPT_HASH_LOAD(lhs), r = LEPT_HASH_LOAD(rhs);
+    return l != 0 && r != 0 && l != r;
+}
+
+/* numbers that are not both doubles */
+static int lept_number_equal(const lept_value *lhs, const lept_value *rhs) {
+    uint64_t ml = 0, mr = 0;
+    int nl = 0, nr = 0, il, ir;
+    if (lhs->flags == rhs->flags && !(lhs->flags & LEPT_VALUE_RAW))
+        return lhs->u.i64 == rhs->u.i64;
+    il = lept_number_integer(lhs, &nl, &ml);
+    ir = lept_number_integer(rhs, &nr, &mr);
+    if (il || ir)
+        return il && ir && nl == nr && ml == mr;
+    return lept_get_number(lhs) == lept_get_number(rhs);
+}
+
+/* two arrays of one size, at least one of them packed */
+static int lept_packed_equal(const lept_value *lhs, const lept_value *rhs) {
+    lept_value le, re;
+    const lept_value *l = &le, *r = &re;
+    size_t i;
+    if ((lhs->flags & rhs->flags & LEPT_VALUE_PACKED) &&
+        !((lhs->flags ^ rhs->flags) & LEPT_VALUE_INT64)) {
+        if (memcmp(lhs->u.a.e, rhs->u.a.e, lhs->u.a.size * PACKED_SIZE) == 0)
+            return 1;
+        if (lhs->flags & LEPT_VALUE_INT64)
+            return 0;
+        /* doubles may still differ only as -0.0 and 0.0 do */
+    }
+    for (i = 0; i < lhs->u.a.size; ++i) {
+        if (lhs->flags & LEPT_VALUE_PACKED)
+            lept_packed_element(lhs, i, &le);
+        else
+            l = &lhs->u.a.e[i];
+        if (rhs->flags & LEPT_VALUE_PACKED)
+            lept_packed_element(rhs, i, &re);
+        else
+            r = &rhs->u.a.e[i];
+        if (l->type != LEPT_NUMBER || r->type != LEPT_NUMBER)
+            return 0;
+        if ((l->flags | r->flags) == 0 ? l->u.n != r->u.n : !lept_number_equal(l, r))
+            return 0;
+    }
+    return 1;
+}
+
+/* compares everything but the children of arrays and objects */
+static inline int lept_is_equal_shallow(const lept_value *lhs, const lept_value *rhs) {
     if (lhs->type != rhs->type)
         return 0;
     switch (lhs->type) {
@@ -578,46 +2838,696 @@ int lept_is_equal(const lept_value *lhs, const lept_value *rhs) {
             return lhs->u.s.len == rhs->u.s.len &&
                          memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
         case LEPT_NUMBER:
-            return lhs->u.n == rhs->u.n;
+            if ((lhs->flags | rhs->flags) == 0)
+                return lhs->u.n == rhs->u.n;
+            return lept_number_equal(lhs, rhs);
         case LEPT_ARRAY:
-            if (lhs->u.a.size != rhs->u.a.size)
-                return 0;
-            for (size_t i = 0; i < lhs->u.a.size; ++i)
-                if (lept_is_equal(lhs->u.a.e + i, rhs->u.a.e + i) == 0)
-                    return 0;
-            return 1;
+            return lhs->u.a.size == rhs->u.a.size &&
+                   (!((lhs->flags | rhs->flags) & LEPT_VALUE_PACKED) ||
+                    lept_packed_equal(lhs, rhs));
         case LEPT_OBJECT:
-            if (lhs->u.o.size != rhs->u.o.size)
-                return 0;
-            for (size_t i = 0; i < lhs->u.o.size; ++i) {
-                if (lhs->u.o.m[i].klen != rhs->u.o.m[i].klen)
-                    return 0;
-                if (memcmp(lhs->u.o.m[i].k, rhs->u.o.m[i].k, lhs->u.o.m[i].klen) != 0)
-                    return 0;
-                if (lept_is_equal(&lhs->u.o.m[i].v, &rhs->u.o.m[i].v) == 0)
-                    return 0;
-            }
-            return 1;
+            return lhs->u.o.size == rhs->u.o.size;
         default:
             return 1;
     }
 }
 
-void lept_copy(lept_value *dst, const lept_value *src) {
-    assert(dst != NULL && src != NULL);
+/*
+ * Members of two objects pair up by position while the keys agree. At the
+ * first disagreement both sides are sorted by key (members with equal keys
+ * keeping their order) and compared again from the start in that order,
+ * with `sorted` holding the members of lhs, then those of rhs.
+ */
+typedef struct {
+    const lept_value *lhs, *rhs;
+    size_t i;
+    const lept_member **sorted;
+} lept_equal_frame;
+
+static int lept_member_compare(const void *a, const void *b) {
+    const lept_member *x = *(const lept_member *const *)a, *y = *(const lept_member *const *)b;
+    int ret = memcmp(x->k, y->k, x->klen < y->klen ? x->klen : y->klen);
+    if (ret == 0)
+        ret = x->klen != y->klen ? (x->klen < y->klen ? -1 : 1) : (x < y ? -1 : x > y);
+    return ret;
+}
+
+static void lept_sort_members(const lept_member **s, const lept_value *o) {
+    size_t i;
+    for (i = 0; i < o->u.o.size; ++i)
+        s[i] = &o->u.o.m[i];
+    qsort((void *)s, o->u.o.size, sizeof(lept_member *), lept_member_compare);
+}
+
+/* switches f to sorted order, false if the keys differ */
+static int lept_equal_unordered(lept_equal_frame *f) {
+    size_t i, n = f->lhs->u.o.size;
+    const lept_member **ml, **mr;
+    f->sorted = ml = (const lept_member **)malloc(2 * n * sizeof(lept_member *));
+    lept_sort_members(ml, f->lhs);
+    lept_sort_members(mr = ml + n, f->rhs);
+    f->i = 0;
+    for (i = 0; i < n; ++i)
+        if (ml[i]->klen != mr[i]->klen || memcmp(ml[i]->k, mr[i]->k, ml[i]->klen) != 0)
+            return 0;
+    return 1;
+}
+
+int lept_is_equal(const lept_value *lhs, const lept_value *rhs) {
+    lept_equal_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    int ret = 1;
+    assert(lhs != NULL && rhs != NULL);
+    if (lept_hash_differ(lhs, rhs) || !lept_is_equal_shallow(lhs, rhs))
+        return 0;
+    /* packed arrays were compared in full */
+    if (!ISCONTAINER(lhs) || !ISCONTAINER(rhs))
+        return 1;
+    WALK_INIT(walk, local);
+    f = (lept_equal_frame *)lept_context_push(&walk, sizeof(lept_equal_frame));
+    f->lhs = lhs;
+    f->rhs = rhs;
+    f->i = 0;
+    f->sorted = NULL;
+    while (walk.top > 0) {
+        const lept_value *l, *r;
+        f = WALK_TOP(walk, lept_equal_frame);
+        if (f->i == CHILDREN(f->lhs)) {
+            if (f->sorted != NULL)
+                free((void *)f->sorted);
+            lept_context_pop(&walk, sizeof(lept_equal_frame));
+            continue;
+        }
+        if (f->sorted != NULL) {
+            l = &f->sorted[f->i]->v;
+            r = &f->sorted[f->i + f->lhs->u.o.size]->v;
+        } else if (f->lhs->type == LEPT_OBJECT) {
+            const lept_member *ml = &f->lhs->u.o.m[f->i], *mr = &f->rhs->u.o.m[f->i];
+            if (ml->k != mr->k &&
+                (ml->klen != mr->klen || memcmp(ml->k, mr->k, ml->klen) != 0)) {
+                if (!lept_equal_unordered(f)) {
+                    ret = 0;
+                    break;
+                }
+                continue;
+            }
+            l = &ml->v;
+            r = &mr->v;
+        } else {
+            l = &f->lhs->u.a.e[f->i];
+            r = &f->rhs->u.a.e[f->i];
+        }
+        ++f->i;
+        if (lept_hash_differ(l, r) || !lept_is_equal_shallow(l, r)) {
+            ret = 0;
+            break;
+        }
+        if (ISCONTAINER(l) && ISCONTAINER(r)) {
+            f = (lept_equal_frame *)lept_context_push(&walk, sizeof(lept_equal_frame));
+            f->lhs = l;
+            f->rhs = r;
+            f->i = 0;
+            f->sorted = NULL;
+        }
+    }
+    /* sorted members of the objects still open after a difference */
+    for (f = (lept_equal_frame *)walk.stack; (char *)f < walk.stack + walk.top; ++f)
+        free((void *)f->sorted);
+    WALK_FREE(walk);
+    return ret;
+}
+
+/*
+ * Hashes mix 64-bit words in multiply-xorshift rounds and are folded to 32
+ * bits at the end, with 0 kept for "not cached". Array elements are
+ * chained in order; object members are summed, so their order is lost.
+ */
+#define LEPT_HASH_K1 0x9e3779b97f4a7c15ull
+#define LEPT_HASH_K2 0xbf58476d1ce4e5b9ull
+
+static uint64_t lept_hash_mix(uint64_t h) {
+    h ^= h >> 31;
+    h *= LEPT_HASH_K2;
+    h ^= h >> 29;
+    h *= LEPT_HASH_K1;
+    return h ^ (h >> 32);
+}
+
+static uint64_t lept_hash_bytes(const char *s, size_t len) {
+    uint64_t h = len * LEPT_HASH_K1, w;
+    for (; len >= 8; s += 8, len -= 8) {
+        memcpy(&w, s, 8);
+        h = (h ^ w * LEPT_HASH_K2) * LEPT_HASH_K1;
+        h ^= h >> 29;
+    }
+    w = 0;
+    memcpy(&w, s, len);
+    return lept_hash_mix(h ^ w);
+}
+
+static uint32_t lept_hash_fold(uint64_t h) {
+    uint32_t r = (uint32_t)(h ^ (h >> 32));
+    return r != 0 ? r : 1;
+}
+
+/*
+ * The hash of a string, scalar or packed array (the same as unpacked);
+ * other arrays and objects only get their seed here.
+ */
+static uint64_t lept_hash_leaf(const lept_value *v) {
+    uint32_t h;
+    uint64_t bits;
+    double n;
+    int neg;
+    if (ISPACKED(v)) {
+        if ((h = LEPT_HASH_LOAD(v)) == 0) {
+            uint64_t a = lept_hash_mix(((uint64_t)v->u.a.size << 3) + LEPT_ARRAY);
+            lept_value e;
+            size_t i;
+            for (i = 0; i < v->u.a.size; ++i) {
+                lept_packed_element(v, i, &e);
+                a = (a ^ lept_hash_leaf(&e)) * LEPT_HASH_K1;
+                a ^= a >> 31;
+            }
+            LEPT_HASH_STORE(v, h = lept_hash_fold(lept_hash_mix(a)));
+        }
+        return h;
+    }
+    switch (v->type) {
+        case LEPT_STRING:
+            if ((h = LEPT_HASH_LOAD(v)) == 0)
+                LEPT_HASH_STORE(v, h = lept_hash_fold(lept_hash_bytes(v->u.s.s, v->u.s.len)));
+            return h;
+        case LEPT_NUMBER:
+            if (lept_number_integer(v, &neg, &bits))
+                return lept_hash_mix(bits ^ (neg ? LEPT_HASH_K1 : 0));
+            n = lept_get_number(v);
+            memcpy(&bits, &n, sizeof(bits));
+            return lept_hash_mix(bits ^ LEPT_HASH_K2);
+        default:
+            return lept_hash_mix(((uint64_t)(ISCONTAINER(v) ? CHILDREN(v) : 0) << 3) + v->type);
+    }
+}
+
+typedef struct {
+    const lept_value *v;
+    size_t i;
+    uint64_t h;
+} lept_hash_frame;
+
+uint32_t lept_hash(const lept_value *v) {
+    lept_hash_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    uint32_t h;
+    assert(v != NULL);
+    if (!ISCONTAINER(v))
+        return lept_hash_fold(lept_hash_leaf(v));
+    if ((h = LEPT_HASH_LOAD(v)) != 0)
+        return h;
+    WALK_INIT(walk, local);
+    f = (lept_hash_frame *)lept_context_push(&walk, sizeof(lept_hash_frame));
+    f->v = v;
+    f->i = 0;
+    f->h = lept_hash_leaf(v);
+    while (1) {
+        const lept_value *e;
+        uint64_t eh;
+        f = WALK_TOP(walk, lept_hash_frame);
+        if (f->i < CHILDREN(f->v)) {
+            e = CHILD(f->v, f->i);
+            if (ISCONTAINER(e) && (eh = LEPT_HASH_LOAD(e)) == 0) {
+                f = (lept_hash_frame *)lept_context_push(&walk, sizeof(lept_hash_frame));
+                f->v = e;
+                f->i = 0;
+                f->h = lept_hash_leaf(e);
+                continue;
+            }
+            if (!ISCONTAINER(e))
+                eh = lept_hash_leaf(e);
+        } else {
+            e = f->v;
+            LEPT_HASH_STORE(e, h = lept_hash_fold(lept_hash_mix(f->h)));
+            lept_context_pop(&walk, sizeof(lept_hash_frame));
+            if (walk.top == 0)
+                break;
+            eh = h;
+            f = WALK_TOP(walk, lept_hash_frame);
+        }
+        if (f->v->type == LEPT_ARRAY) {
+            f->h = (f->h ^ eh) * LEPT_HASH_K1;
+            f->h ^= f->h >> 31;
+        } else {
+            const lept_member *m = &f->v->u.o.m[f->i];
+            f->h += lept_hash_mix(lept_hash_bytes(m->k, m->klen) ^ eh * LEPT_HASH_K2);
+        }
+        ++f->i;
+    }
+    WALK_FREE(walk);
+    return h;
+}
+
+void lept_hash_clear(lept_value *v) {
+    lept_free_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    assert(v != NULL);
+    v->hash = 0;
+    if (!ISCONTAINER(v))
+        return;
+    WALK_INIT(walk, local);
+    f = (lept_free_frame *)lept_context_push(&walk, sizeof(lept_free_frame));
+    f->v = v;
+    f->i = 0;
+    while (walk.top > 0) {
+        lept_value *e;
+        f = WALK_TOP(walk, lept_free_frame);
+        if (f->i == CHILDREN(f->v)) {
+            lept_context_pop(&walk, sizeof(lept_free_frame));
+            continue;
+        }
+        e = CHILD(f->v, f->i);
+        ++f->i;
+        e->hash = 0;
+        if (ISCONTAINER(e)) {
+            f = (lept_free_frame *)lept_context_push(&walk, sizeof(lept_free_frame));
+            f->v = e;
+            f->i = 0;
+        }
+    }
+    WALK_FREE(walk);
+}
+
+typedef struct {
+    lept_value *dst;
+    const lept_value *src;
+    size_t i;
+} lept_copy_frame;
+
+static void lept_copy_packed(lept_value *dst, const lept_value *src, const lept_allocator *a,
+                             int unpack) {
+    size_t i, n = src->u.a.size;
+    dst->type = LEPT_ARRAY;
+    dst->u.a.size = n;
+    if (unpack) {
+        dst->u.a.e = (lept_value *)lept_value_alloc(dst, a, n * sizeof(lept_value));
+        for (i = 0; i < n; ++i)
+            lept_packed_element(src, i, &dst->u.a.e[i]);
+    } else {
+        dst->u.a.e = (lept_value *)memcpy(lept_value_alloc(dst, a, n * PACKED_SIZE),
+                                          src->u.a.e, n * PACKED_SIZE);
+        dst->flags |= src->flags & (LEPT_VALUE_PACKED | LEPT_VALUE_INT64);
+    }
+}
+
+/*
+ * Copies src into the uninitialized dst, leaving the children of containers,
+ * and tells whether they still need copying. Bodies come from `a`. A copy
+ * for a shared document is never written by a read: numbers are decoded and
+ * arrays unpacked.
+ */
+static int lept_copy_shallow(lept_value *dst, const lept_value *src, const lept_allocator *a,
+                             int shared) {
+    size_t size;
+    dst->hash = LEPT_HASH_LOAD(src);
     switch (src->type) {
         case LEPT_STRING:
-            lept_set_string(dst, src->u.s.s, src->u.s.len);
-            break;
+            lept_set_string_a(dst, src->u.s.s, src->u.s.len, a);
+            return 0;
+        case LEPT_NUMBER:
+            memcpy(dst, src, sizeof(lept_value));
+            if (shared && (src->flags & LEPT_VALUE_RAW)) {
+                dst->u.n = lept_get_number(src);
+                dst->flags = 0;
+            }
+            return 0;
         case LEPT_ARRAY:
-            // TODO
-            break;
+            if (src->flags & LEPT_VALUE_PACKED) {
+                lept_copy_packed(dst, src, a, shared);
+                return 0;
+            }
+            dst->type = LEPT_ARRAY;
+            dst->flags = 0;
+            dst->u.a.size = src->u.a.size;
+            size = src->u.a.size * sizeof(lept_value);
+            dst->u.a.e = size ? (lept_value *)lept_value_alloc(dst, a, size) : NULL;
+            return size != 0;
         case LEPT_OBJECT:
-            // TODO
-            break;
+            dst->type = LEPT_OBJECT;
+            dst->flags = 0;
+            dst->u.o.size = src->u.o.size;
+            size = src->u.o.size * sizeof(lept_member);
+            dst->u.o.m = size ? (lept_member *)lept_value_alloc(dst, a, size) : NULL;
+            return size != 0;
         default:
-            lept_free(dst);
             memcpy(dst, src, sizeof(lept_value));
+            return 0;
+    }
+}
+
+static void lept_copy_a(lept_value *dst, const lept_value *src, const lept_allocator *a,
+                        int shared) {
+    lept_copy_frame local[LEPT_WALK_LOCAL_SIZE], *f;
+    lept_context walk;
+    if (!lept_copy_shallow(dst, src, a, shared))
+        return;
+    WALK_INIT(walk, local);
+    f = (lept_copy_frame *)lept_context_push(&walk, sizeof(lept_copy_frame));
+    f->dst = dst;
+    f->src = src;
+    f->i = 0;
+    while (walk.top > 0) {
+        lept_value *d;
+        const lept_value *e;
+        f = WALK_TOP(walk, lept_copy_frame);
+        if (f->i == CHILDREN(f->src)) {
+            lept_context_pop(&walk, sizeof(lept_copy_frame));
+            continue;
+        }
+        if (f->src->type == LEPT_OBJECT) {
+            const lept_member *ms = &f->src->u.o.m[f->i];
+            lept_member *md = &f->dst->u.o.m[f->i];
+            md->k = lept_key_copy(a, ms->k, ms->klen);
+            md->klen = ms->klen;
+        }
+        d = CHILD(f->dst, f->i);
+        e = CHILD(f->src, f->i);
+        ++f->i;
+        if (lept_copy_shallow(d, e, a, shared)) {
+            f = (lept_copy_frame *)lept_context_push(&walk, sizeof(lept_copy_frame));
+            f->dst = d;
+            f->src = e;
+            f->i = 0;
+        }
+    }
+    WALK_FREE(walk);
+}
+
+/* copies always use the default allocator, whatever owns src */
+void lept_copy(lept_value *dst, const lept_value *src) {
+    assert(dst != NULL && src != NULL && dst != src);
+    lept_free(dst);
+    lept_copy_a(dst, src, &lept_std_allocator, 0);
+}
+
+/*
+ * Shared documents. Every body of a document has a header, so handing a
+ * subtree to another document or keeping an untouched branch across an
+ * edit only bumps its count. Bodies are never written once shared: an edit
+ * copies the containers along its path into the new document (their
+ * children shared with the old one) and leaves everything else alone.
+ */
+struct lept_doc {
+    size_t refs;
+    const lept_allocator *a;
+    lept_value root;
+};
+
+/* same functions as the default allocator, but its bodies get headers */
+static const lept_allocator lept_shared_allocator = {
+    lept_std_malloc, lept_std_realloc, lept_std_free, NULL
+};
+
+static lept_doc *lept_doc_new(const lept_allocator *a) {
+    lept_doc *d = (lept_doc *)a->malloc(a->user, sizeof(lept_doc));
+    d->refs = 1;
+    d->a = a;
+    lept_init(&d->root);
+    return d;
+}
+
+int lept_doc_parse(lept_doc **doc, const char *json, const lept_parse_options *opt) {
+    lept_parse_options o;
+    int ret;
+    assert(doc != NULL);
+    if (opt != NULL)
+        o = *opt;
+    else
+        memset(&o, 0, sizeof(o));
+    if (o.allocator == NULL)
+        o.allocator = &lept_shared_allocator;
+    /* readers must not write the number cache or unpack */
+    o.flags &= ~(LEPT_PARSE_LAZY_NUMBERS | LEPT_PARSE_PACK_NUMBERS);
+    *doc = lept_doc_new(o.allocator);
+    if ((ret = lept_parse_ex(&(*doc)->root, json, &o)) != LEPT_PARSE_OK) {
+        lept_doc_release(*doc);
+        *doc = NULL;
+    }
+    return ret;
+}
+
+lept_doc *lept_doc_retain(lept_doc *d) {
+    assert(d != NULL);
+    LEPT_ATOMIC_INC(&d->refs);
+    return d;
+}
+
+void lept_doc_release(lept_doc *d) {
+    if (d == NULL)
+        return;
+    if (LEPT_ATOMIC_LOAD(&d->refs) == 1 || LEPT_ATOMIC_DEC(&d->refs) == 0) {
+        lept_free(&d->root);
+        d->a->free(d->a->user, d, sizeof(lept_doc));
+    }
+}
+
+const lept_value *lept_doc_root(const lept_doc *d) {
+    assert(d != NULL);
+    return &d->root;
+}
+
+/*
+ * Steps over the next "/token" of the JSON Pointer *p, unescaping it in
+ * place ("~0" is '~', "~1" is '/'); NULL at the end of the pointer.
+ */
+static char *lept_pointer_next(char **p, size_t *len) {
+    char *tok, *w;
+    if (**p != '/')
+        return NULL;
+    tok = w = ++*p;
+    for (; **p != '\0' && **p != '/'; ++*p) {
+        if (**p == '~' && ((*p)[1] == '0' || (*p)[1] == '1'))
+            *w++ = *++*p == '0' ? '~' : '/';
+        else
+            *w++ = **p;
+    }
+    *len = (size_t)(w - tok);
+    return tok;
+}
+
+/* index of the child of v named by a token, LEPT_KEY_NOT_EXIST if none */
+static size_t lept_pointer_index(const lept_value *v, const char *tok, size_t len) {
+    size_t i, index = 0;
+    if (v->type == LEPT_OBJECT)
+        return lept_find_object_index(v, tok, len);
+    if (v->type != LEPT_ARRAY || len == 0 || (len > 1 && tok[0] == '0'))
+        return LEPT_KEY_NOT_EXIST;
+    for (i = 0; i < len; ++i) {
+        if (!ISDIGIT(tok[i]) || index > (v->u.a.size - 1) / 10)
+            return LEPT_KEY_NOT_EXIST;
+        index = index * 10 + (size_t)(tok[i] - '0');
+    }
+    return index < v->u.a.size ? index : LEPT_KEY_NOT_EXIST;
+}
+
+/* a writable copy of a pointer, or NULL (and `ret` set) if it is malformed */
+static char *lept_pointer_copy(const char *pointer, int *ret) {
+    size_t len;
+    char *p;
+    assert(pointer != NULL);
+    if (*pointer != '\0' && *pointer != '/') {
+        *ret = LEPT_POINTER_INVALID;
+        return NULL;
+    }
+    len = strlen(pointer);
+    memcpy(p = (char *)malloc(len + 1), pointer, len + 1);
+    return p;
+}
+
+lept_value *lept_serializer_touch(lept_serializer *s, lept_value *root, const char *pointer) {
+    lept_serializer_node **slot;
+    lept_value *v = root;
+    char *path, *p, *tok;
+    size_t len, i;
+    int ret;
+    assert(s != NULL && root != NULL);
+    if ((path = lept_pointer_copy(pointer, &ret)) == NULL)
+        return NULL;
+    slot = root == s->root && s->tree != NULL ? &s->tree : NULL;
+    for (p = path; (tok = lept_pointer_next(&p, &len)) != NULL; v = CHILD(v, i)) {
+        if ((i = lept_pointer_index(v, tok, len)) == LEPT_KEY_NOT_EXIST) {
+            v = NULL;
             break;
+        }
+        v->hash = 0;
+        if (ISPACKED(v))
+            lept_unpack(v);
+        if (slot != NULL && *slot != NULL && i < (*slot)->n) {
+            (*slot)->dirty = 1;
+            slot = &(*slot)->child[i];
+        } else {
+            slot = NULL;
+        }
     }
-}
\ No newline at end of file
+    free(path);
+    if (v != NULL && slot != NULL) {
+        lept_node_free(s->alloc, *slot);
+        *slot = NULL;
+    }
+    return v;
+}
+
+const lept_value *lept_doc_find(const lept_doc *d, const char *pointer) {
+    const lept_value *v = &d->root;
+    char *path, *p, *tok;
+    size_t len, i;
+    int ret;
+    assert(d != NULL);
+    if ((path = lept_pointer_copy(pointer, &ret)) == NULL)
+        return NULL;
+    for (p = path; v != NULL && (tok = lept_pointer_next(&p, &len)) != NULL; )
+        v = (i = lept_pointer_index(v, tok, len)) != LEPT_KEY_NOT_EXIST ? CHILD(v, i) : NULL;
+    free(path);
+    return v;
+}
+
+lept_doc *lept_doc_subtree(lept_doc *d, const char *pointer) {
+    const lept_value *v = lept_doc_find(d, pointer);
+    lept_doc *sub;
+    if (v == NULL)
+        return NULL;
+    sub = lept_doc_new(d->a);
+    memcpy(&sub->root, v, sizeof(lept_value));
+    lept_value_ref(v);
+    return sub;
+}
+
+/*
+ * Gives container v a body of its own from `a`, sharing the children with
+ * the old one: the child at `drop` (if any) is left out, and there is room
+ * for `extra` more after the others.
+ */
+static void lept_value_unshare(lept_value *v, const lept_allocator *a, size_t drop,
+                               size_t extra) {
+    lept_value old = *v;
+    size_t i, j, n = CHILDREN(v), size = n - (drop < n) + extra;
+    v->hash = 0;
+    if (v->type == LEPT_ARRAY)
+        v->u.a.e = size ? (lept_value *)lept_value_alloc(v, a, size * sizeof(lept_value)) : NULL;
+    else
+        v->u.o.m = size ? (lept_member *)lept_value_alloc(v, a, size * sizeof(lept_member)) : NULL;
+    for (i = j = 0; i < n; ++i) {
+        if (i == drop)
+            continue;
+        if (v->type == LEPT_OBJECT) {
+            const lept_member *ms = &old.u.o.m[i];
+            lept_member *md = &v->u.o.m[j];
+            md->k = lept_key_copy(a, ms->k, ms->klen);
+            md->klen = ms->klen;
+        }
+        memcpy(CHILD(v, j), CHILD(&old, i), sizeof(lept_value));
+        lept_value_ref(CHILD(v, j));
+        ++j;
+    }
+    if (v->type == LEPT_ARRAY)
+        v->u.a.size = j;
+    else
+        v->u.o.size = j;
+    lept_free(&old);
+}
+
+/*
+ * Starts the edited copy of d and walks `pointer` in it, unsharing every
+ * container on the way. Stops at the last token when `last` is given,
+ * which then receives it; returns the value reached.
+ */
+static lept_value *lept_doc_edit(lept_doc **out, const lept_doc *d, const char *pointer,
+                                 char **path, char **last, size_t *last_len, int *ret) {
+    lept_value *v;
+    char *p, *tok;
+    size_t len, i;
+    assert(out != NULL && d != NULL);
+    *out = NULL;
+    if ((*path = lept_pointer_copy(pointer, ret)) == NULL)
+        return NULL;
+    *out = lept_doc_new(d->a);
+    v = &(*out)->root;
+    memcpy(v, &d->root, sizeof(lept_value));
+    lept_value_ref(v);
+    for (p = *path; (tok = lept_pointer_next(&p, &len)) != NULL; v = CHILD(v, i)) {
+        if (last != NULL && *p == '\0') {
+            *last = tok;
+            *last_len = len;
+            break;
+        }
+        if ((i = lept_pointer_index(v, tok, len)) == LEPT_KEY_NOT_EXIST) {
+            *ret = LEPT_POINTER_NOT_FOUND;
+            return NULL;
+        }
+        lept_value_unshare(v, d->a, LEPT_KEY_NOT_EXIST, 0);
+    }
+    *ret = LEPT_POINTER_OK;
+    return v;
+}
+
+/*
+ * lept_doc_set and lept_doc_remove leave d as it is and give the edited
+ * document in *out (NULL on failure). Setting a missing object member adds
+ * it, and "-" as the last token appends to an array. The value set is
+ * copied, as the caller may go on changing it.
+ */
+int lept_doc_set(lept_doc **out, const lept_doc *d, const char *pointer, const lept_value *value) {
+    char *path, *last = NULL;
+    size_t len = 0, i;
+    int ret;
+    lept_value *v = lept_doc_edit(out, d, pointer, &path, &last, &len, &ret);
+    assert(value != NULL);
+    if (v != NULL && last != NULL) {
+        if ((i = lept_pointer_index(v, last, len)) != LEPT_KEY_NOT_EXIST) {
+            lept_value_unshare(v, d->a, LEPT_KEY_NOT_EXIST, 0);
+            v = CHILD(v, i);
+        } else if (v->type == LEPT_OBJECT) {
+            lept_member *m;
+            lept_value_unshare(v, d->a, LEPT_KEY_NOT_EXIST, 1);
+            m = &v->u.o.m[v->u.o.size++];
+            m->k = lept_key_new(d->a, last, len);
+            m->klen = len;
+            v = &m->v;
+        } else if (v->type == LEPT_ARRAY && len == 1 && last[0] == '-') {
+            lept_value_unshare(v, d->a, LEPT_KEY_NOT_EXIST, 1);
+            v = &v->u.a.e[v->u.a.size++];
+        } else {
+            ret = LEPT_POINTER_NOT_FOUND;
+            v = NULL;
+        }
+    }
+    if (v != NULL) {
+        lept_free(v);
+        lept_copy_a(v, value, d->a, 1);
+    }
+    free(path);
+    if (ret != LEPT_POINTER_OK) {
+        lept_doc_release(*out);
+        *out = NULL;
+    }
+    return ret;
+}
+
+int lept_doc_remove(lept_doc **out, const lept_doc *d, const char *pointer) {
+    char *path, *last = NULL;
+    size_t len = 0, i;
+    int ret;
+    lept_value *v = lept_doc_edit(out, d, pointer, &path, &last, &len, &ret);
+    if (v != NULL) {
+        if (last == NULL)
+            ret = LEPT_POINTER_INVALID;
+        else if ((i = lept_pointer_index(v, last, len)) == LEPT_KEY_NOT_EXIST)
+            ret = LEPT_POINTER_NOT_FOUND;
+        else
+            lept_value_unshare(v, d->a, i, 0);
+    }
+    free(path);
+    if (ret != LEPT_POINTER_OK) {
+        lept_doc_release(*out);
+        *out = NULL;
+    }
+    return ret;
+}
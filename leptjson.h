@@ -1,7 +1,14 @@
-#ifndef ELPTJSON_LEPTJSON_H_
+#ifndef LEPTJSON_LEPTJSON_H_
 #define LEPTJSON_LEPTJSON_H_
 
-#define lept_init(v) do { (v)->type = LEPT_NULL; } while(0)
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* int64_t, uint64_t, uint32_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define lept_init(v) do { (v)->type = LEPT_NULL; (v)->hash = 0; } while(0)
 #define lept_set_null(v) lept_free(v)
 
 typedef enum {
@@ -29,7 +36,17 @@ enum {
     LEPT_PARSE_MISS_KEY,
     LEPT_PARSE_MISS_COLON,
     LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
-    LEPT_STRINGIFY_OK
+    LEPT_PARSE_INVALID_UTF8,
+    LEPT_PARSE_NESTING_TOO_DEEP,
+    LEPT_PARSE_INCOMPLETE,
+    LEPT_PARSE_TOO_MUCH_MEMORY,
+    LEPT_PARSE_STRING_TOO_LONG,
+    LEPT_PARSE_TOO_MANY_ELEMENTS,
+    LEPT_STRINGIFY_OK,
+    LEPT_STRINGIFY_BUFFER_TOO_SMALL,
+    LEPT_POINTER_OK,
+    LEPT_POINTER_INVALID,
+    LEPT_POINTER_NOT_FOUND
 };
 
 typedef struct lept_value lept_value;
@@ -41,8 +58,13 @@ struct lept_value {
         struct { lept_value *e; size_t size; } a;
         struct { char *s; size_t len; } s;
         double n;
+        int64_t i64;
+        uint64_t u64;
+        struct { const char *p; double n; } r;
     } u;
-    lept_type type;
+    unsigned char type;     /* lept_type */
+    unsigned short flags;   /* private to leptjson.c */
+    uint32_t hash;          /* cached lept_hash, 0 if none (private) */
 };
 
 struct lept_member {
@@ -51,41 +73,312 @@ struct lept_member {
     lept_value v;
 };
 
+/*
+ * Counters for one lept_parse_ex or lept_stringify_ex call, filled in when
+ * requested through the options. Value counts, depth and allocations
+ * describe the resulting (or stringified) tree, so a failed parse only
+ * reports bytes, stack use and times. Building with LEPT_ENABLE_STATS=0
+ * removes the instrumentation; the structure is then only zeroed.
+ */
+#ifndef LEPT_ENABLE_STATS
+#define LEPT_ENABLE_STATS 1
+#endif
+
+typedef struct {
+    size_t bytes;                   /* json consumed (parse) or produced (stringify) */
+    size_t values[LEPT_OBJECT + 1]; /* indexed by lept_type */
+    size_t max_depth;
+    size_t grows, grow_bytes;       /* work stack reallocations and sizes reached */
+    size_t peak_stack;
+    size_t allocs, alloc_bytes;     /* heap blocks handed to the caller */
+    double string_ns, number_ns, structure_ns;
+} lept_stats;
+
+/*
+ * Where a parse or stringify takes its memory from; NULL means malloc. Sizes
+ * are passed back to realloc and free for pool allocators. Strings, keys
+ * and array/object bodies remember the allocator of their document, which
+ * lept_free hands them back to, so it must outlive the document.
+ */
+typedef struct {
+    void *(*malloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *user, void *ptr, size_t size);
+    void *user;
+} lept_allocator;
+
+/* reject strings that are not well-formed UTF-8 (LEPT_PARSE_INVALID_UTF8) */
+#define LEPT_PARSE_VALIDATE_UTF8 0x1
+/*
+ * Keep numbers other than int64/uint64 integers as pointers into the json
+ * text, which must then outlive the values and their copies. They are only
+ * converted (and cached) by the first lept_get_number, and stringify writes
+ * the original text back. Not used by lept_doc_parse, whose values are read
+ * concurrently.
+ */
+#define LEPT_PARSE_LAZY_NUMBERS  0x2
+/*
+ * Store arrays of numbers only as one int64_t[] (all integers) or double[]
+ * (integers beyond 2^53 or lazy numbers keep them unpacked), readable at
+ * once through lept_get_array_int64s/lept_get_array_doubles, and element
+ * by element through lept_peek_array_element. lept_get_array_element needs
+ * it turned back into values by lept_unpack_array first; everything else
+ * takes it as it is. Not used by lept_doc_parse, and lept_doc_set copies
+ * unpacked.
+ */
+#define LEPT_PARSE_PACK_NUMBERS  0x4
+/* for lept_parser_next: nothing follows the buffer, report truncation as such */
+#define LEPT_PARSE_STREAM_END    0x8
+
+/* zero-initialize for the defaults of lept_parse */
+typedef struct {
+    unsigned flags;
+    /*
+     * Only materialize the branches named by `paths` (JSON Pointers, e.g.
+     * "/user/name"; "" selects the whole document). Arrays are transparent:
+     * "/items/id" keeps "id" of every element of "items". Everything else is
+     * grammar-checked and skipped without decoding or allocating.
+     */
+    const char *const *paths;
+    size_t path_count;
+    /* most arrays and objects open at once, 0 for LEPT_PARSE_MAX_DEPTH (1024) */
+    size_t max_depth;
+    lept_stats *stats;
+    const lept_allocator *allocator;
+    /*
+     * Limits for untrusted input, 0 for none. Parsing stops with
+     * LEPT_PARSE_TOO_MUCH_MEMORY, LEPT_PARSE_STRING_TOO_LONG or
+     * LEPT_PARSE_TOO_MANY_ELEMENTS (freeing everything) as soon as one is
+     * crossed: the bytes asked of the allocators at once, for all strings,
+     * keys and array and object bodies with their headers and for the
+     * parser's stack (checked before each allocation, so the peak stays
+     * within it); the bytes of one decoded string or key; the elements or
+     * members of one array or object.
+     */
+    size_t max_bytes;
+    size_t max_string_length;
+    size_t max_elements;
+} lept_parse_options;
+
 int lept_parse(lept_value *v, const char *json);
+int lept_parse_ex(lept_value *v, const char *json, const lept_parse_options *opt);
+int lept_parse_projection(lept_value *v, const char *json,
+                          const char *const *paths, size_t count);
+
+/*
+ * A parser keeps its stack and projection scratch space between calls,
+ * giving back whatever exceeds `max_retained` bytes after each one. Its
+ * own memory comes from `a` (NULL for malloc); the values it builds come
+ * from the allocator in the options, as with lept_parse_ex.
+ */
+typedef struct lept_parser lept_parser;
+
+lept_parser *lept_parser_create(const lept_allocator *a, size_t max_retained);
+void lept_parser_destroy(lept_parser *p);
+int lept_parser_parse(lept_parser *p, lept_value *v, const char *json,
+                      const lept_parse_options *opt);
+/*
+ * Parses the next of a sequence of documents (concatenated, or separated by
+ * whitespace as in NDJSON) in json[0, len), starting at *offset; json[len]
+ * must be '\0'. On success *offset is just past the document. Otherwise it
+ * is at the start of the one that failed: LEPT_PARSE_INCOMPLETE means the
+ * buffer ends before the document does (or before any, when *offset == len),
+ * so keep json + *offset, append more input and call again. A number right
+ * at the end counts as incomplete too, unless LEPT_PARSE_STREAM_END is set,
+ * which reports the errors of lept_parse instead.
+ */
+int lept_parser_next(lept_parser *p, lept_value *v, const char *json, size_t len,
+                     size_t *offset, const lept_parse_options *opt);
+/*
+ * Checks json[0, len) with the grammar and error codes of lept_parse without
+ * building any value (and without UTF-8 validation). `offset` (optional)
+ * receives where checking stopped.
+ */
+int lept_validate(const char *json, size_t len, size_t *offset);
 
 void lept_free(lept_value *v);
 
+/*
+ * A reclaimer frees documents later, a slice at a time, so that dropping a
+ * large one costs the caller nothing where latency matters. lept_reclaimer_defer
+ * takes over v in O(1), leaving it null; `bytes` is what v holds if known
+ * (e.g. lept_stats.alloc_bytes, or the length of its json as an estimate),
+ * 0 otherwise, and only feeds lept_reclaimer_pending_bytes.
+ * lept_reclaimer_drain frees in queue order until a little over `budget`
+ * bytes of strings, keys and bodies are given back, and returns how many;
+ * call it at idle points. lept_reclaimer_flush frees everything and
+ * lept_reclaimer_destroy flushes before it goes. The allocators of the
+ * deferred documents must outlive the reclaimer, whose own memory comes
+ * from `a` (NULL for malloc). A reclaimer is not thread-safe: to drain it
+ * from a thread of your own, hold one lock around every call.
+ */
+typedef struct lept_reclaimer lept_reclaimer;
+
+lept_reclaimer *lept_reclaimer_create(const lept_allocator *a);
+void lept_reclaimer_destroy(lept_reclaimer *r);
+void lept_reclaimer_defer(lept_reclaimer *r, lept_value *v, size_t bytes);
+size_t lept_reclaimer_drain(lept_reclaimer *r, size_t budget);
+void lept_reclaimer_flush(lept_reclaimer *r);
+/* documents not yet freed, and the bytes they were deferred with still not given back */
+size_t lept_reclaimer_pending(const lept_reclaimer *r);
+size_t lept_reclaimer_pending_bytes(const lept_reclaimer *r);
+
 lept_type lept_get_type(const lept_value *v);
 
 int lept_get_boolean(const lept_value *v);
 void lept_set_boolean(lept_value *v, int b);
 
+/*
+ * Integers that fit in an int64 (or, when positive, a uint64) are kept
+ * exactly; other numbers are doubles. lept_get_number converts any of them,
+ * lept_get_int64 needs LEPT_NUMBER_INT64, and lept_get_uint64 needs
+ * LEPT_NUMBER_UINT64 or a non-negative LEPT_NUMBER_INT64. Numbers compare
+ * by value whatever their representation.
+ */
+typedef enum {
+    LEPT_NUMBER_DOUBLE,
+    LEPT_NUMBER_INT64,
+    LEPT_NUMBER_UINT64
+} lept_number_type;
+
 double lept_get_number(const lept_value *v);
 void lept_set_number(lept_value *v, double n);
+lept_number_type lept_get_number_type(const lept_value *v);
+int64_t lept_get_int64(const lept_value *v);
+uint64_t lept_get_uint64(const lept_value *v);
+void lept_set_int64(lept_value *v, int64_t n);
+void lept_set_uint64(lept_value *v, uint64_t n);
 
 const char *lept_get_string(const lept_value *v);
 size_t lept_get_string_length(const lept_value *v);
 void lept_set_string(lept_value *v, const char *s, size_t len);
 
 size_t lept_get_array_size(const lept_value *v);
+/* not for a packed array, see LEPT_PARSE_PACK_NUMBERS */
 lept_value *lept_get_array_element(const lept_value *v, size_t index);
+/*
+ * Element index of any array, read only: in the array, or for a packed one
+ * written to *buffer. It never changes v, so threads may share the tree.
+ */
+const lept_value *lept_peek_array_element(const lept_value *v, size_t index, lept_value *buffer);
+/* the elements of a packed array and their count, NULL if not packed that way */
+const double *lept_get_array_doubles(const lept_value *v, size_t *size);
+const int64_t *lept_get_array_int64s(const lept_value *v, size_t *size);
+/* turns a packed array back into values, which ends what the two above returned */
+void lept_unpack_array(lept_value *v);
 
 size_t lept_get_object_size(const lept_value *v);
 const char *lept_get_object_key(const lept_value *v, size_t index);
 size_t lept_get_object_key_length(const lept_value *v, size_t index);
 lept_value *lept_get_object_value(const lept_value *v, size_t index);
 
+/* zero-initialize for the defaults of lept_stringify */
+typedef struct {
+    lept_stats *stats;
+    /* also owns the returned json, which is then exactly *length + 1 bytes */
+    const lept_allocator *allocator;
+} lept_stringify_options;
+
 int lept_stringify(const lept_value *v, char **json, size_t *length);
+int lept_stringify_ex(const lept_value *v, char **json, size_t *length,
+                      const lept_stringify_options *opt);
+/*
+ * Writes v and a '\0' into buffer[0, size), like snprintf: *length
+ * (optional) receives the length of the whole output either way, and if
+ * that leaves no room for the '\0' the buffer gets as much as fits and
+ * LEPT_STRINGIFY_BUFFER_TOO_SMALL is returned. Only then is memory taken
+ * (from the allocator of the options) for the rest. lept_stringify_length
+ * gives that length without writing anything.
+ */
+int lept_stringify_buffer(const lept_value *v, char *buffer, size_t size, size_t *length,
+                          const lept_stringify_options *opt);
+size_t lept_stringify_length(const lept_value *v);
+
+/*
+ * A serializer writes into a buffer it owns and reuses: *json stays valid
+ * until the next write or lept_serializer_destroy. A buffer grown beyond
+ * `max_retained` bytes is dropped at the next write. The allocator of the
+ * options is not used.
+ */
+typedef struct lept_serializer lept_serializer;
+
+lept_serializer *lept_serializer_create(const lept_allocator *a, size_t max_retained);
+void lept_serializer_destroy(lept_serializer *s);
+int lept_serializer_write(lept_serializer *s, const lept_value *v, const char **json,
+                          size_t *length, const lept_stringify_options *opt);
+
+/*
+ * An incremental serializer remembers where each array and object of the
+ * value it last wrote is in its output, and writing the same value again
+ * copies that text for all but those changed since. Get a value to change
+ * in place from lept_serializer_touch (NULL if the JSON Pointer names
+ * none), which marks the containers on its path and forgets the text of
+ * the value itself; changing anything else must go through a touch of it or
+ * of a container above it. Touching also resets the cached lept_hash of the
+ * path. Writing another value starts over, and so does writing one that
+ * was freed or parsed into since (a value written by two incremental
+ * serializers is then only told apart by the address of its body).
+ */
+void lept_serializer_set_incremental(lept_serializer *s, int on);
+lept_value *lept_serializer_touch(lept_serializer *s, lept_value *root, const char *pointer);
 
 size_t lept_find_object_index(const lept_value *v, const char *key, size_t klen);
 lept_value *lept_find_object_value(lept_value *v, const char *key, size_t klen);
+/*
+ * Tries index *hint first and keeps the index found there: looking a key
+ * up in every record of an array, whose objects mostly share one shape, is
+ * then O(1). Start *hint at 0.
+ */
+size_t lept_find_object_index_hint(const lept_value *v, const char *key, size_t klen,
+                                   size_t *hint);
+/*
+ * Objects are equal when they have the same members in any order (members
+ * with the same key still compare in their order).
+ */
 int lept_is_equal(const lept_value *lhs, const lept_value *rhs);
 
-void lept_copy(lept_value *dst, const lept_value *src); // TODO: finised partly
+/*
+ * A structural hash, the same for equal values. It is cached in the
+ * strings, arrays and objects it covers, so hashing again is O(1),
+ * lept_is_equal returns at once for two values whose cached hashes differ
+ * and lept_copy carries them over. Setters only reset the cache of the
+ * value they change, not of the arrays and objects above it: after changing
+ * a hashed tree in place, call lept_hash_clear on its root before
+ * lept_hash, lept_is_equal or lept_copy see it again, or they work with
+ * stale hashes (lept_serializer_touch clears its path itself). Shared
+ * documents never need it.
+ */
+uint32_t lept_hash(const lept_value *v);
+void lept_hash_clear(lept_value *v);
+
+void lept_copy(lept_value *dst, const lept_value *src);
+
+/*
+ * An immutable document shared by reference count. Retaining and
+ * releasing are atomic, and nothing reachable from lept_doc_root is ever
+ * written, so any number of threads can read a document they hold without
+ * locking. A subtree handle shares its part of the document, and edits
+ * make a new document which only copies the containers on the edited path.
+ * Pointers are JSON Pointers ("" is the whole document).
+ */
+typedef struct lept_doc lept_doc;
+
+int lept_doc_parse(lept_doc **doc, const char *json, const lept_parse_options *opt);
+lept_doc *lept_doc_retain(lept_doc *d);
+void lept_doc_release(lept_doc *d);
+const lept_value *lept_doc_root(const lept_doc *d);
+const lept_value *lept_doc_find(const lept_doc *d, const char *pointer);
+lept_doc *lept_doc_subtree(lept_doc *d, const char *pointer);
+int lept_doc_set(lept_doc **out, const lept_doc *d, const char *pointer, const lept_value *value);
+int lept_doc_remove(lept_doc **out, const lept_doc *d, const char *pointer);
 void lept_move(lept_value *dst, lept_value *src); // TODO
 void lept_swap(lept_value *dst, lept_value *src); // TODO
 
 // TODO: 修改lept_value的结构为动态数组
 // TODO: 修改后的配套设置数组的函数
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // LEPTJSON_LEPTJSON_H
\ No newline at end of file
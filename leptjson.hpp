@@ -0,0 +1,265 @@
+#ifndef LEPTJSON_LEPTJSON_HPP_
+#define LEPTJSON_LEPTJSON_HPP_
+
+/*
+ * C++17 wrapper over leptjson.h. Value and Document own a lept_value and
+ * free it, they move but copy only through copy(). Ref is a non-owning
+ * handle into a tree, valid as long as its owner; strings and keys are
+ * handed out as std::string_view into the tree. Everything is inline and
+ * goes straight to the C API (get() gives it the lept_value).
+ */
+
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "leptjson.h"
+
+namespace lept {
+
+struct Member;
+
+class Ref {
+public:
+    class ElementIterator;
+    class MemberIterator;
+    template <class Iterator> class Range;
+
+    Ref() noexcept : v_(nullptr) {}
+    explicit Ref(lept_value *v) noexcept : v_(v) {}
+
+    /* false for what operator[] did not find */
+    explicit operator bool() const noexcept { return v_ != nullptr; }
+    lept_value *get() const noexcept { return v_; }
+
+    lept_type type() const noexcept { return lept_get_type(v_); }
+    /* all false for a false Ref */
+    bool is_null() const noexcept { return is(LEPT_NULL); }
+    bool is_bool() const noexcept { return is(LEPT_TRUE) || is(LEPT_FALSE); }
+    bool is_number() const noexcept { return is(LEPT_NUMBER); }
+    bool is_string() const noexcept { return is(LEPT_STRING); }
+    bool is_array() const noexcept { return is(LEPT_ARRAY); }
+    bool is_object() const noexcept { return is(LEPT_OBJECT); }
+
+    bool boolean() const noexcept { return lept_get_boolean(v_) != 0; }
+    double number() const noexcept { return lept_get_number(v_); }
+    lept_number_type number_type() const noexcept { return lept_get_number_type(v_); }
+    int64_t int64() const noexcept { return lept_get_int64(v_); }
+    uint64_t uint64() const noexcept { return lept_get_uint64(v_); }
+    std::string_view string() const noexcept {
+        return std::string_view(lept_get_string(v_), lept_get_string_length(v_));
+    }
+
+    /* elements of an array or members of an object, 0 for anything else */
+    size_t size() const noexcept {
+        return is_array() ? v_->u.a.size : is_object() ? v_->u.o.size : 0;
+    }
+    /*
+     * A false Ref if there is no such element, or this is not an array. An
+     * element of a packed array is not a lept_value either, see elements().
+     */
+    Ref operator[](size_t index) const noexcept {
+        lept_value number;
+        const lept_value *e;
+        if (!is_array() || index >= v_->u.a.size)
+            return Ref();
+        e = lept_peek_array_element(v_, index, &number);
+        return e != &number ? Ref(const_cast<lept_value *>(e)) : Ref();
+    }
+    /* a false Ref if there is no such member, or this is not an object */
+    Ref operator[](std::string_view key) const noexcept {
+        if (v_ == nullptr || v_->type != LEPT_OBJECT)
+            return Ref();
+        return Ref(lept_find_object_value(v_, key.data() != nullptr ? key.data() : "",
+                                          key.size()));
+    }
+
+    /* empty for anything but an array or an object respectively */
+    inline Range<ElementIterator> elements() const noexcept;
+    inline Range<MemberIterator> members() const noexcept;
+
+    /* json text of the value, "" if it cannot be written */
+    std::string stringify() const {
+        std::string json(lept_stringify_length(v_), '\0');
+        if (lept_stringify_buffer(v_, json.data(), json.size() + 1, nullptr, nullptr) !=
+            LEPT_STRINGIFY_OK)
+            json.clear();
+        return json;
+    }
+
+    friend bool operator==(Ref lhs, Ref rhs) noexcept {
+        return lept_is_equal(lhs.v_, rhs.v_) != 0;
+    }
+    friend bool operator!=(Ref lhs, Ref rhs) noexcept { return !(lhs == rhs); }
+
+protected:
+    lept_value *v_;
+
+private:
+    bool is(lept_type type) const noexcept { return v_ != nullptr && v_->type == type; }
+};
+
+struct Member {
+    std::string_view key;
+    Ref value;
+};
+
+class Ref::ElementIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Ref;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Ref;
+
+    /* over the values from e, or the numbers of packed if not null */
+    ElementIterator(lept_value *e, const lept_value *packed, size_t i) noexcept
+        : e_(e), packed_(packed), i_(i) {}
+    /* a number of a packed array is copied into the iterator, valid until it moves on */
+    Ref operator*() const noexcept {
+        if (packed_ == nullptr)
+            return Ref(e_ + i_);
+        return Ref(const_cast<lept_value *>(lept_peek_array_element(packed_, i_, &number_)));
+    }
+    ElementIterator &operator++() noexcept { ++i_; return *this; }
+    ElementIterator operator++(int) noexcept { ElementIterator it = *this; ++i_; return it; }
+    bool operator==(const ElementIterator &rhs) const noexcept { return i_ == rhs.i_; }
+    bool operator!=(const ElementIterator &rhs) const noexcept { return i_ != rhs.i_; }
+
+private:
+    lept_value *e_;
+    const lept_value *packed_;
+    size_t i_;
+    mutable lept_value number_;
+};
+
+class Ref::MemberIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Member;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Member;
+
+    explicit MemberIterator(lept_member *m) noexcept : m_(m) {}
+    Member operator*() const noexcept {
+        return Member{ std::string_view(m_->k, m_->klen), Ref(&m_->v) };
+    }
+    MemberIterator &operator++() noexcept { ++m_; return *this; }
+    MemberIterator operator++(int) noexcept { MemberIterator it = *this; ++m_; return it; }
+    bool operator==(const MemberIterator &rhs) const noexcept { return m_ == rhs.m_; }
+    bool operator!=(const MemberIterator &rhs) const noexcept { return m_ != rhs.m_; }
+
+private:
+    lept_member *m_;
+};
+
+template <class Iterator>
+class Ref::Range {
+public:
+    Range(Iterator first, Iterator last) noexcept : first_(first), last_(last) {}
+    Iterator begin() const noexcept { return first_; }
+    Iterator end() const noexcept { return last_; }
+
+private:
+    Iterator first_, last_;
+};
+
+/* reads a packed array as it is, so threads may walk one tree at once */
+inline Ref::Range<Ref::ElementIterator> Ref::elements() const noexcept {
+    size_t n = is_array() ? v_->u.a.size : 0;
+    lept_value number;
+    lept_value *e = n > 0 ? v_->u.a.e : nullptr;
+    const lept_value *packed =
+        n > 0 && lept_peek_array_element(v_, 0, &number) == &number ? v_ : nullptr;
+    return Range<ElementIterator>(ElementIterator(e, packed, 0), ElementIterator(e, packed, n));
+}
+
+inline Ref::Range<Ref::MemberIterator> Ref::members() const noexcept {
+    lept_member *m = is_object() ? v_->u.o.m : nullptr;
+    size_t n = m != nullptr ? v_->u.o.size : 0;
+    return Range<MemberIterator>(MemberIterator(m), MemberIterator(m + n));
+}
+
+class Value : public Ref {
+public:
+    Value() noexcept : Ref(&value_) { lept_init(&value_); }
+    explicit Value(bool b) noexcept : Value() { lept_set_boolean(&value_, b); }
+    explicit Value(double n) noexcept : Value() { lept_set_number(&value_, n); }
+    explicit Value(int64_t n) noexcept : Value() { lept_set_int64(&value_, n); }
+    explicit Value(uint64_t n) noexcept : Value() { lept_set_uint64(&value_, n); }
+    explicit Value(int n) noexcept : Value(static_cast<int64_t>(n)) {}
+    explicit Value(std::string_view s) : Value() {
+        lept_set_string(&value_, s.data() != nullptr ? s.data() : "", s.size());
+    }
+    explicit Value(const char *s) : Value(std::string_view(s)) {}
+    /* takes over v, leaving it null */
+    explicit Value(lept_value *v) noexcept : Ref(&value_) {
+        std::memcpy(&value_, v, sizeof(lept_value));
+        lept_init(v);
+    }
+    ~Value() { lept_free(&value_); }
+
+    Value(const Value &) = delete;
+    Value &operator=(const Value &) = delete;
+    Value(Value &&rhs) noexcept : Value(&rhs.value_) {}
+    Value &operator=(Value &&rhs) noexcept {
+        if (this != &rhs) {
+            lept_free(&value_);
+            std::memcpy(&value_, &rhs.value_, sizeof(lept_value));
+            lept_init(&rhs.value_);
+        }
+        return *this;
+    }
+
+    Value copy() const {
+        Value v;
+        lept_copy(&v.value_, &value_);
+        return v;
+    }
+    /* hands the tree over to the caller, who must lept_free it */
+    lept_value release() noexcept {
+        lept_value v = value_;
+        lept_init(&value_);
+        return v;
+    }
+
+protected:
+    lept_value value_;
+};
+
+/* the result of a parse: its root, and the error if it failed */
+class Document : public Value {
+public:
+    Document() noexcept : error_(LEPT_PARSE_EXPECT_VALUE) {}
+    explicit Document(const char *json, const lept_parse_options *opt = nullptr) noexcept
+        : error_(LEPT_PARSE_OK) {
+        parse(json, opt);
+    }
+    explicit Document(const std::string &json, const lept_parse_options *opt = nullptr) noexcept
+        : Document(json.c_str(), opt) {}
+    Document(Document &&rhs) noexcept = default;
+    Document &operator=(Document &&rhs) noexcept = default;
+
+    /* replaces the root, which stays null on error */
+    int parse(const char *json, const lept_parse_options *opt = nullptr) noexcept {
+        lept_free(&value_);
+        return error_ = lept_parse_ex(&value_, json, opt);
+    }
+    int parse(const std::string &json, const lept_parse_options *opt = nullptr) noexcept {
+        return parse(json.c_str(), opt);
+    }
+
+    int error() const noexcept { return error_; }
+    bool ok() const noexcept { return error_ == LEPT_PARSE_OK; }
+    Ref root() const noexcept { return *this; }
+
+private:
+    int error_;
+};
+
+} // namespace lept
+
+#endif // LEPTJSON_LEPTJSON_HPP_
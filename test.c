@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "leptjson.h"
@@ -24,9 +25,9 @@ static int test_pass = 0;
 #define EXPECT_EQ_DOUBLE(expect, actual) \
         EXPECT_EQ_BASE((expect) == actual, expect, actual, "%f")
 #define EXPECT_EQ_TRUE(actual) \
-    do { EXPECT_EQ_BASE(actual != 0, "true", "false", "%s"); } while(0)
+    do { EXPECT_EQ_BASE((actual) != 0, "true", "false", "%s"); } while(0)
 #define EXPECT_EQ_FALSE(actual) \
-    do { EXPECT_EQ_BASE(actual == 0, "false", "true", "%s"); } while(0)
+    do { EXPECT_EQ_BASE((actual) == 0, "false", "true", "%s"); } while(0)
 #define EXPECT_EQ_STRING(expect, string, alength) \
     do { EXPECT_EQ_BASE(memcmp(expect, string, alength) == 0, \
                       expect, string, "%s"); \
@@ -46,6 +47,7 @@ static int test_pass = 0;
         v.type = LEPT_FALSE; \
         EXPECT_EQ_INT(error, lept_parse(&v, json)); \
         EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v)); \
+        EXPECT_EQ_INT(error, lept_validate(json, strlen(json), NULL)); \
     } while(0)
 
 #define TEST_NUMBER(expect, json) \
@@ -87,6 +89,141 @@ static void test_parse_false() {
     EXPECT_EQ_INT(LEPT_FALSE, lept_get_type(&v));
 }
 
+#define TEST_INTEGER(expect, json) \
+    do { \
+        lept_value v; \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json)); \
+        EXPECT_EQ_INT(LEPT_NUMBER_INT64, lept_get_number_type(&v)); \
+        EXPECT_EQ_TRUE(lept_get_int64(&v) == (expect)); \
+    } while(0)
+
+static void test_parse_integer() {
+    lept_value a, b;
+    TEST_INTEGER(0, "0");
+    TEST_INTEGER(-1, "-1");
+    TEST_INTEGER(9007199254740993, "9007199254740993"); /* 2^53 + 1 */
+    TEST_INTEGER(INT64_MAX, "9223372036854775807");
+    TEST_INTEGER(INT64_MIN, "-9223372036854775808");
+
+    lept_init(&a);
+    lept_init(&b);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "18446744073709551615"));
+    EXPECT_EQ_INT(LEPT_NUMBER_UINT64, lept_get_number_type(&a));
+    EXPECT_EQ_TRUE(lept_get_uint64(&a) == UINT64_MAX);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "9223372036854775808"));
+    EXPECT_EQ_TRUE(lept_get_uint64(&a) == (uint64_t)INT64_MAX + 1);
+
+    /* out of range, fractions, exponents and -0 stay doubles */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "18446744073709551616"));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&a));
+    EXPECT_EQ_DOUBLE(18446744073709551616.0, lept_get_number(&a));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "-9223372036854775809"));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&a));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "100000000000000000000000"));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&a));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "1.0"));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&a));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "1e2"));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&a));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "-0"));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&a));
+
+    /* numbers compare and hash by value */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "[100,-3,9223372036854775808]"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, "[1e2,-3.0,9.223372036854775808e18]"));
+    EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+    EXPECT_EQ_TRUE(lept_hash(&a) == lept_hash(&b));
+    lept_free(&a);
+    lept_free(&b);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "9007199254740993"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, "9007199254740992.0"));
+    EXPECT_EQ_FALSE(lept_is_equal(&a, &b));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "0.5"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, "0"));
+    EXPECT_EQ_FALSE(lept_is_equal(&a, &b));
+}
+
+static void test_parse_shape() {
+    const char *json = "[{\"id\":1,\"p\":{\"x\":0}},{\"id\":2,\"p\":{\"x\":1}},"
+                       "{\"p\":3,\"\\u0069d\":4},{\"id\":5}]";
+    lept_value v, c, *e[4];
+    size_t i, hint = 0;
+    lept_init(&v);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    for (i = 0; i < 4; ++i)
+        e[i] = lept_get_array_element(&v, i);
+    /* records in a row share their keys, nested ones too */
+    EXPECT_EQ_TRUE(lept_get_object_key(e[0], 0) == lept_get_object_key(e[1], 0));
+    EXPECT_EQ_TRUE(lept_get_object_key(e[0], 1) == lept_get_object_key(e[1], 1));
+    EXPECT_EQ_TRUE(lept_get_object_key(lept_get_object_value(e[0], 1), 0) ==
+                   lept_get_object_key(lept_get_object_value(e[1], 1), 0));
+    EXPECT_EQ_STRING("p", lept_get_object_key(e[2], 0), lept_get_object_key_length(e[2], 0));
+    EXPECT_EQ_STRING("id", lept_get_object_key(e[2], 1), lept_get_object_key_length(e[2], 1));
+    EXPECT_EQ_TRUE(lept_get_object_key(e[2], 1) != lept_get_object_key(e[1], 0));
+    EXPECT_EQ_STRING("id", lept_get_object_key(e[3], 0), lept_get_object_key_length(e[3], 0));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_get_object_value(lept_get_object_value(e[1], 1), 0)));
+    EXPECT_EQ_DOUBLE(4.0, lept_get_number(lept_get_object_value(e[2], 1)));
+
+    EXPECT_EQ_SIZE_T((size_t)0, lept_find_object_index_hint(e[0], "id", 2, &hint));
+    EXPECT_EQ_SIZE_T((size_t)1, lept_find_object_index_hint(e[2], "id", 2, &hint));
+    EXPECT_EQ_SIZE_T((size_t)1, hint);
+    EXPECT_EQ_SIZE_T((size_t)0, lept_find_object_index_hint(e[3], "id", 2, &hint));
+    EXPECT_EQ_SIZE_T((size_t)0, hint);
+    EXPECT_EQ_SIZE_T((size_t)-1, lept_find_object_index_hint(e[3], "p", 1, &hint));
+    EXPECT_EQ_SIZE_T((size_t)0, hint);
+
+    lept_copy(&c, &v);
+    EXPECT_EQ_TRUE(lept_get_object_key(lept_get_array_element(&c, 0), 0) == lept_get_object_key(e[0], 0));
+    EXPECT_EQ_TRUE(lept_is_equal(&c, &v));
+    lept_free(&v);
+    lept_free(&c);
+
+    /* a key predicted from one written with escapes is read again */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[{\"\\\\n\":1},{\"\\n\":2}]"));
+    EXPECT_EQ_STRING("\\n", lept_get_object_key(lept_get_array_element(&v, 0), 0), 2);
+    EXPECT_EQ_STRING("\n", lept_get_object_key(lept_get_array_element(&v, 1), 0), 1);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COLON, lept_parse(&v, "[{\"a\\\"b\":1},{\"a\"b\":2}]"));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, lept_parse(&v, "[{\"ab\":1},{\"ab\":2 \"ab\"}]"));
+}
+
+static void test_parse_lazy_numbers() {
+    const char *json = "[1.50,2E+03,-0.0,0.1e-5,12,-7,1e-400]";
+    lept_parse_options opt;
+    lept_value v, e, c;
+    char *out;
+    size_t length;
+    memset(&opt, 0, sizeof(opt));
+    opt.flags = LEPT_PARSE_LAZY_NUMBERS;
+    lept_init(&v);
+    lept_init(&e);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, json));
+    /* written back as they were read */
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &out, &length));
+    EXPECT_EQ_STRING(json, out, length);
+    free(out);
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(lept_get_array_element(&v, 0)));
+    EXPECT_EQ_INT(LEPT_NUMBER_INT64, lept_get_number_type(lept_get_array_element(&v, 4)));
+    EXPECT_EQ_DOUBLE(1.5, lept_get_number(lept_get_array_element(&v, 0)));
+    EXPECT_EQ_DOUBLE(2000.0, lept_get_number(lept_get_array_element(&v, 1)));
+    EXPECT_EQ_DOUBLE(1.5, lept_get_number(lept_get_array_element(&v, 0)));
+    EXPECT_EQ_TRUE(lept_is_equal(&v, &e));
+    EXPECT_EQ_TRUE(lept_hash(&v) == lept_hash(&e));
+    lept_copy(&c, &v);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&c, &out, &length));
+    EXPECT_EQ_STRING(json, out, length);
+    free(out);
+    lept_free(&v);
+    lept_free(&e);
+    lept_free(&c);
+
+    EXPECT_EQ_INT(LEPT_PARSE_NUMBER_TOO_BIG, lept_parse_ex(&v, "[1.5,-1e309]", &opt));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_ex(&v, "[1.5,1.e3]", &opt));
+}
+
 static void test_parse_expect_value() {
     TEST_ERROR(LEPT_PARSE_EXPECT_VALUE, "");
     TEST_ERROR(LEPT_PARSE_EXPECT_VALUE, "  ");
@@ -261,6 +398,18 @@ static void test_access_number() {
     lept_set_string(&v, "a", 1);
     lept_set_number(&v, 1234.5);
     EXPECT_EQ_DOUBLE(1234.5, lept_get_number(&v));
+    EXPECT_EQ_INT(LEPT_NUMBER_DOUBLE, lept_get_number_type(&v));
+    lept_set_int64(&v, -42);
+    EXPECT_EQ_INT(LEPT_NUMBER_INT64, lept_get_number_type(&v));
+    EXPECT_EQ_TRUE(lept_get_int64(&v) == -42);
+    EXPECT_EQ_DOUBLE(-42.0, lept_get_number(&v));
+    lept_set_uint64(&v, 7);
+    EXPECT_EQ_INT(LEPT_NUMBER_INT64, lept_get_number_type(&v));
+    EXPECT_EQ_TRUE(lept_get_uint64(&v) == 7);
+    lept_set_uint64(&v, UINT64_MAX);
+    EXPECT_EQ_INT(LEPT_NUMBER_UINT64, lept_get_number_type(&v));
+    EXPECT_EQ_TRUE(lept_get_uint64(&v) == UINT64_MAX);
+    EXPECT_EQ_DOUBLE(18446744073709551615.0, lept_get_number(&v));
     lept_free(&v);
 }
 
@@ -359,11 +508,897 @@ static void test_parse_miss_comma_or_curly_bracket() {
     TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
 }
 
+#define TEST_PROJECTION(expect, json, ...) \
+    do { \
+        const char *paths[] = { __VA_ARGS__ }; \
+        lept_value v; \
+        char *json2; \
+        size_t len; \
+        lept_init(&v); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projection(&v, json, paths, \
+                      sizeof(paths) / sizeof(paths[0]))); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &json2, &len)); \
+        EXPECT_EQ_SIZE_T(strlen(expect), len); \
+        EXPECT_EQ_STRING(expect, json2, len); \
+        free(json2); \
+        lept_free(&v); \
+    } while(0)
+
+#define TEST_PROJECTION_ERROR(error, json, path) \
+    do { \
+        const char *paths[] = { path }; \
+        lept_value v; \
+        v.type = LEPT_FALSE; \
+        EXPECT_EQ_INT(error, lept_parse_projection(&v, json, paths, 1)); \
+        EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v)); \
+    } while(0)
+
+static void test_parse_projection() {
+    const char *doc = "{\"id\":7,\"user\":{\"name\":\"x\",\"tags\":[1,2]},"
+                      "\"items\":[{\"id\":1,\"p\":2},{\"p\":3},4,{\"id\":5}],"
+                      "\"a/b\":{\"~\":true}}";
+    TEST_PROJECTION(doc, doc, "");
+    TEST_PROJECTION("{}", doc, "/missing");
+    TEST_PROJECTION("{\"id\":7}", doc, "/id");
+    TEST_PROJECTION("{\"user\":{\"name\":\"x\"}}", doc, "/user/name");
+    TEST_PROJECTION("{\"id\":7,\"user\":{\"name\":\"x\",\"tags\":[1,2]}}",
+                    doc, "/user/name", "/id", "/user");
+    TEST_PROJECTION("{\"items\":[{\"id\":1},{},{\"id\":5}]}", doc, "/items/id");
+    TEST_PROJECTION("{\"a/b\":{\"~\":true}}", doc, "/a~1b/~0");
+    TEST_PROJECTION("{}", doc, "/id/deeper");
+    TEST_PROJECTION("[{\"k\":\"\\n\"},{\"k\":null}]", "[{\"k\":\"\\n\",\"z\":0},{\"\\u006b\":null}]", "/k");
+    TEST_PROJECTION("null", "123", "/a");
+
+    /* skipped values are still grammar-checked */
+    TEST_PROJECTION_ERROR(LEPT_PARSE_INVALID_VALUE, "{\"a\":1,\"b\":[1,]}", "/a");
+    TEST_PROJECTION_ERROR(LEPT_PARSE_INVALID_STRING_ESCAPE, "{\"b\":\"\\v\"}", "/a");
+    TEST_PROJECTION_ERROR(LEPT_PARSE_MISS_COLON, "{\"b\":{\"c\"}}", "/a");
+    TEST_PROJECTION_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"b\":{\"c\":1", "/a");
+    TEST_PROJECTION_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "{\"b\":\"abc", "/a");
+    TEST_PROJECTION_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "{\"a\":1} x", "/a");
+}
+
+static void test_validate() {
+    size_t offset;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(" [1, {\"a\":[]}] ", 15, &offset));
+    EXPECT_EQ_SIZE_T((size_t)15, offset);
+    /* only `len` bytes are looked at */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate("[1]]", 3, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
+                  lept_validate("[1,2]", 4, &offset));
+    EXPECT_EQ_SIZE_T((size_t)4, offset);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_QUOTATION_MARK, lept_validate("\"ab\"", 3, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UNICODE_HEX, lept_validate("\"\\u00A2\"", 6, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_validate("", 0, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_validate("tru", 3, &offset));
+    EXPECT_EQ_SIZE_T((size_t)3, offset);
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_validate("1 2", 3, &offset));
+    EXPECT_EQ_SIZE_T((size_t)2, offset);
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate("1.7976931348623157e308", 22, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate("0.0001e310", 10, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_NUMBER_TOO_BIG, lept_validate("1.8e308", 7, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_NUMBER_TOO_BIG, lept_validate("[1e99999999999999999999]", 24, NULL));
+
+    /* a long mantissa overflows through a negative exponent too, alike everywhere */
+    {
+        static const char *exponents[] = { "e-10", "e-100", "E-91", "e-92" };
+        static const char *const path = "/other";
+        lept_parse_options opt;
+        lept_value v;
+        char json[512];
+        size_t i;
+        memset(&opt, 0, sizeof(opt));
+        opt.paths = &path;
+        opt.path_count = 1;
+        lept_init(&v);
+        for (i = 0; i < sizeof(exponents) / sizeof(exponents[0]); ++i) {
+            int expect = i == 0 || i == 2 ? LEPT_PARSE_NUMBER_TOO_BIG : LEPT_PARSE_OK;
+            memset(json, 0, sizeof(json));
+            memcpy(json, "{\"k\":1", 6);
+            memset(json + 6, '0', 400);
+            strcat(json, exponents[i]);
+            EXPECT_EQ_INT(expect, lept_parse(&v, json + 5));
+            lept_free(&v);
+            EXPECT_EQ_INT(expect, lept_validate(json + 5, strlen(json + 5), NULL));
+            strcat(json, "}");
+            EXPECT_EQ_INT(expect, lept_parse_ex(&v, json, &opt));
+            lept_free(&v);
+        }
+    }
+}
+
+#define TEST_UTF8(error, json) \
+    do { \
+        lept_parse_options opt; \
+        lept_value v; \
+        memset(&opt, 0, sizeof(opt)); \
+        opt.flags = LEPT_PARSE_VALIDATE_UTF8; \
+        lept_init(&v); \
+        EXPECT_EQ_INT(error, lept_parse_ex(&v, json, &opt)); \
+        lept_free(&v); \
+        opt.paths = &path; \
+        opt.path_count = 1; \
+        EXPECT_EQ_INT(error, lept_parse_ex(&v, "{\"k\":" json "}", &opt)); \
+        lept_free(&v); \
+    } while(0)
+
+static void test_parse_utf8() {
+    const char *path = "/other";
+    TEST_UTF8(LEPT_PARSE_OK, "\"Hello \xC2\xA2 \xE2\x82\xAC \xF0\x9D\x84\x9E\"");
+    TEST_UTF8(LEPT_PARSE_OK, "\"\xED\x9F\xBF\xEE\x80\x80\xF4\x8F\xBF\xBF\"");
+    TEST_UTF8(LEPT_PARSE_OK, "\"0123456789abcdef\xE2\x82\xAC" "0123456789abcdef\\n"
+                             "\xC2\xA2\xC2\xA2\xC2\xA2\xC2\xA2\xC2\xA2\xC2\xA2\xC2\xA2\xC2\xA2\"");
+    TEST_UTF8(LEPT_PARSE_OK, "\"\\uD834\\uDD1E\"");
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\x80\"");                 /* stray continuation */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xC0\x80\"");             /* overlong */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xE0\x9F\xBF\"");         /* overlong */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xED\xA0\x80\"");         /* surrogate */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xF4\x90\x80\x80\"");     /* above U+10FFFF */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xF5\x80\x80\x80\"");
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xE2\x82\"");             /* truncated */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xE2\x82\\n\xAC\"");       /* split by an escape */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"0123456789abcdef0123456789abcde\xF0\x9D\x84\"");
+    TEST_UTF8(LEPT_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uDD1E\"");
+
+    /* without the flag bytes are taken as they are */
+    TEST_STRING("\xC0\x80", "\"\xC0\x80\"");
+}
+
+static char *nested(const char *open, const char *close, size_t depth) {
+    size_t lo = strlen(open), lc = strlen(close);
+    char *json = (char *)malloc(depth * (lo + lc) + 1), *p = json;
+    for (size_t i = 0; i < depth; ++i, p += lo)
+        memcpy(p, open, lo);
+    for (size_t i = 0; i < depth; ++i, p += lc)
+        memcpy(p, close, lc);
+    *p = '\0';
+    return json;
+}
+
+static void test_parse_nesting() {
+    const char *none = NULL;
+    lept_parse_options opt;
+    lept_value v;
+    char *json;
+    memset(&opt, 0, sizeof(opt));
+
+    json = nested("[", "]", 1024);
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, strlen(json), NULL));
+    free(json);
+
+    json = nested("{\"a\":[", "]}", 513);
+    TEST_ERROR(LEPT_PARSE_NESTING_TOO_DEEP, json);
+    opt.max_depth = 1026;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt));
+    lept_free(&v);
+    opt.max_depth = 1025;
+    v.type = LEPT_TRUE;
+    EXPECT_EQ_INT(LEPT_PARSE_NESTING_TOO_DEEP, lept_parse_ex(&v, json, &opt));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+    free(json);
+
+    /* a hostile payload fails fast and leaves the C stack alone */
+    json = nested("[", "", 1000000);
+    TEST_ERROR(LEPT_PARSE_NESTING_TOO_DEEP, json);
+    opt.max_depth = 2000000;
+    v.type = LEPT_TRUE;
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_parse_ex(&v, json, &opt));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+    free(json);
+
+    /* skipped subtrees count too */
+    opt.max_depth = 7;
+    opt.paths = &none;
+    opt.path_count = 0;
+    v.type = LEPT_TRUE;
+    EXPECT_EQ_INT(LEPT_PARSE_NESTING_TOO_DEEP, lept_parse_ex(&v, "{\"a\":[[[[[[[[]]]]]]]]}", &opt));
+    opt.max_depth = 9;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "{\"a\":[[[[[[[[]]]]]]]]}", &opt));
+    lept_free(&v);
+}
+
+static void test_stats() {
+#if LEPT_ENABLE_STATS
+    const char *json = " {\"a\":[1,2,\"xy\"],\"b\":null} ";
+    lept_parse_options opt;
+    lept_stringify_options sopt;
+    lept_stats st;
+    lept_value v;
+    char *out;
+    size_t length;
+    memset(&opt, 0, sizeof(opt));
+    memset(&sopt, 0, sizeof(sopt));
+    opt.stats = sopt.stats = &st;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt));
+    EXPECT_EQ_SIZE_T(strlen(json), st.bytes);
+    EXPECT_EQ_SIZE_T((size_t)1, st.values[LEPT_OBJECT]);
+    EXPECT_EQ_SIZE_T((size_t)1, st.values[LEPT_ARRAY]);
+    EXPECT_EQ_SIZE_T((size_t)2, st.values[LEPT_NUMBER]);
+    EXPECT_EQ_SIZE_T((size_t)1, st.values[LEPT_STRING]);
+    EXPECT_EQ_SIZE_T((size_t)1, st.values[LEPT_NULL]);
+    EXPECT_EQ_SIZE_T((size_t)2, st.max_depth);
+    EXPECT_EQ_SIZE_T((size_t)1, st.grows);
+    EXPECT_EQ_TRUE((st.peak_stack > 0 && st.peak_stack <= st.grow_bytes));
+    /* two keys, one string, two vectors */
+    EXPECT_EQ_SIZE_T((size_t)5, st.allocs);
+    EXPECT_EQ_SIZE_T(2 * 2 + 3 + 3 * sizeof(lept_value) + 2 * sizeof(lept_member), st.alloc_bytes);
+    EXPECT_EQ_TRUE((st.string_ns >= 0 && st.number_ns >= 0 && st.structure_ns >= 0));
+
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify_ex(&v, &out, &length, &sopt));
+    EXPECT_EQ_SIZE_T(length, st.bytes);
+    EXPECT_EQ_SIZE_T((size_t)2, st.values[LEPT_NUMBER]);
+    EXPECT_EQ_SIZE_T((size_t)2, st.max_depth);
+    EXPECT_EQ_SIZE_T((size_t)1, st.allocs);
+    free(out);
+    lept_free(&v);
+
+    /* stopped at the error, nothing was handed out */
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parse_ex(&v, "[1,2 3]", &opt));
+    EXPECT_EQ_SIZE_T((size_t)5, st.bytes);
+    EXPECT_EQ_SIZE_T((size_t)0, st.values[LEPT_NUMBER]);
+    EXPECT_EQ_SIZE_T((size_t)0, st.allocs);
+#endif
+}
+
+typedef struct {
+    size_t blocks, bytes, calls, peak;
+} test_heap;
+
+static void *test_malloc(void *user, size_t size) {
+    test_heap *h = (test_heap *)user;
+    ++h->blocks;
+    ++h->calls;
+    h->bytes += size;
+    if (h->bytes > h->peak)
+        h->peak = h->bytes;
+    return malloc(size);
+}
+
+static void *test_realloc(void *user, void *ptr, size_t old_size, size_t new_size) {
+    test_heap *h = (test_heap *)user;
+    ++h->calls;
+    h->bytes += new_size - old_size;
+    if (h->bytes > h->peak)
+        h->peak = h->bytes;
+    return realloc(ptr, new_size);
+}
+
+static void test_free(void *user, void *ptr, size_t size) {
+    test_heap *h = (test_heap *)user;
+    --h->blocks;
+    h->bytes -= size;
+    free(ptr);
+}
+
+static void test_allocator() {
+    test_heap heap = { 0, 0, 0, 0 };
+    lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+    lept_parse_options opt;
+    lept_stringify_options sopt;
+    lept_value v, c;
+    char *json;
+    size_t length;
+    a.user = &heap;
+    memset(&opt, 0, sizeof(opt));
+    memset(&sopt, 0, sizeof(sopt));
+    opt.allocator = sopt.allocator = &a;
+
+    lept_init(&v);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "{\"a\":[1,\"xy\",[]],\"bc\":{\"d\":\"\"}}", &opt));
+    EXPECT_EQ_TRUE(heap.blocks > 0);
+    /* copies are independent of the allocator of their source */
+    lept_copy(&c, &v);
+    lept_free(&v);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+
+    heap.calls = 0;
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify_ex(&c, &json, &length, &sopt));
+    EXPECT_EQ_TRUE(heap.calls > 0);
+    EXPECT_EQ_SIZE_T((size_t)1, heap.blocks);
+    EXPECT_EQ_SIZE_T(length + 1, heap.bytes);
+    test_free(&heap, json, length + 1);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+    lept_free(&c);
+
+    /* an error gives back everything taken so far */
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+                  lept_parse_ex(&v, "[{\"a\":\"x\",\"b\":[\"y\"] \"c\":1}]", &opt));
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+}
+
+static void test_reclaim() {
+    test_heap heap = { 0, 0, 0, 0 };
+    lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+    lept_parse_options opt;
+    lept_reclaimer *r = lept_reclaimer_create(NULL);
+    lept_value v, s, n;
+    size_t blocks, freed = 0, slices = 0;
+    a.user = &heap;
+    memset(&opt, 0, sizeof(opt));
+    opt.allocator = &a;
+
+    lept_init(&v);
+    lept_init(&s);
+    lept_init(&n);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v,
+        "[{\"a\":\"xyz\",\"b\":[1,2,[]]},{\"a\":\"uvw\",\"b\":{}},\"s\",[[[\"t\"]]]]", &opt));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&s, "\"abc\"", &opt));
+    lept_set_number(&n, 1.0);
+    blocks = heap.blocks;
+    lept_reclaimer_defer(r, &v, 1000);
+    lept_reclaimer_defer(r, &s, 4);
+    lept_reclaimer_defer(r, &n, 0);
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&s));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&n));
+    /* nothing is freed until drained, and a number was never queued */
+    EXPECT_EQ_SIZE_T(blocks, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)2, lept_reclaimer_pending(r));
+    EXPECT_EQ_SIZE_T((size_t)1004, lept_reclaimer_pending_bytes(r));
+
+    /* the smallest budget still makes progress, in queue order */
+    freed = lept_reclaimer_drain(r, 0);
+    EXPECT_EQ_TRUE(freed > 0);
+    EXPECT_EQ_TRUE(heap.blocks > 0);
+    EXPECT_EQ_SIZE_T((size_t)2, lept_reclaimer_pending(r));
+    EXPECT_EQ_SIZE_T((size_t)1004 - freed, lept_reclaimer_pending_bytes(r));
+    while (lept_reclaimer_pending(r) > 0) {
+        size_t pending = lept_reclaimer_pending_bytes(r);
+        freed += lept_reclaimer_drain(r, 0);
+        EXPECT_EQ_TRUE(lept_reclaimer_pending_bytes(r) <= pending);
+        ++slices;
+    }
+    EXPECT_EQ_TRUE(slices > 1);
+    EXPECT_EQ_SIZE_T((size_t)0, lept_reclaimer_pending_bytes(r));
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+    EXPECT_EQ_SIZE_T((size_t)0, lept_reclaimer_drain(r, 100));
+
+    /* destroy flushes */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "{\"k\":[\"x\",{\"y\":null}]}", &opt));
+    lept_reclaimer_defer(r, &v, 0);
+    EXPECT_EQ_TRUE(heap.blocks > 0);
+    lept_reclaimer_destroy(r);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+}
+
+#define TEST_LIMIT(error, json, field, limit) \
+    do { \
+        test_heap heap = { 0, 0, 0, 0 }; \
+        lept_allocator a = { test_malloc, test_realloc, test_free, NULL }; \
+        lept_parse_options opt; \
+        lept_value v; \
+        a.user = &heap; \
+        memset(&opt, 0, sizeof(opt)); \
+        opt.allocator = &a; \
+        opt.field = limit; \
+        lept_init(&v); \
+        EXPECT_EQ_INT(error, lept_parse_ex(&v, json, &opt)); \
+        EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v)); \
+        EXPECT_EQ_SIZE_T((size_t)0, heap.blocks); \
+        EXPECT_EQ_SIZE_T((size_t)0, heap.bytes); \
+    } while(0)
+
+static void test_limits() {
+    lept_parse_options opt;
+    lept_parser *p;
+    lept_value v;
+    size_t offset = 0;
+    TEST_LIMIT(LEPT_PARSE_STRING_TOO_LONG, "\"abcd\"", max_string_length, 3);
+    TEST_LIMIT(LEPT_PARSE_STRING_TOO_LONG, "[\"ab\",\"a\\n\\t\"]", max_string_length, 2);
+    TEST_LIMIT(LEPT_PARSE_STRING_TOO_LONG, "{\"a\":[\"x\"],\"abc\":1}", max_string_length, 2);
+    TEST_LIMIT(LEPT_PARSE_STRING_TOO_LONG, "[\"\\u4e2d\"]", max_string_length, 2);
+    TEST_LIMIT(LEPT_PARSE_TOO_MANY_ELEMENTS, "[1,2,3]", max_elements, 2);
+    TEST_LIMIT(LEPT_PARSE_TOO_MANY_ELEMENTS, "[[],[\"a\",[1,2,3]]]", max_elements, 2);
+    TEST_LIMIT(LEPT_PARSE_TOO_MANY_ELEMENTS, "{\"a\":\"x\",\"b\":{},\"c\":null}", max_elements, 2);
+    TEST_LIMIT(LEPT_PARSE_TOO_MUCH_MEMORY, "[\"abcdefghijklmnopqrstuvwxyz\"]", max_bytes, 16);
+    TEST_LIMIT(LEPT_PARSE_TOO_MUCH_MEMORY, "[{\"a\":[1,2,3]},{\"b\":\"xyz\"},[4,5,6],[7,8,9]]",
+               max_bytes, 256);
+    TEST_LIMIT(LEPT_PARSE_NESTING_TOO_DEEP, "[[[]]]", max_depth, 2);
+
+    /* right at a limit still parses */
+    memset(&opt, 0, sizeof(opt));
+    opt.max_string_length = 3;
+    opt.max_elements = 3;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "{\"abc\":[1,2,\"a\\tb\"],\"b\":{},\"c\":3}", &opt));
+    lept_free(&v);
+    opt.max_string_length = 0;
+    opt.max_elements = 0;
+    opt.max_bytes = 1 << 20;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[{\"a\":[1,2,3]},{\"b\":\"xyz\"},[4,5,6],[7,8,9]]",
+                                               &opt));
+    lept_free(&v);
+
+    /* more input cannot lift a limit */
+    p = lept_parser_create(NULL, 0);
+    opt.max_elements = 2;
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_MANY_ELEMENTS, lept_parser_next(p, &v, "[1,2,3", 6, &offset, &opt));
+    lept_parser_destroy(p);
+
+    /* nothing allocated at once goes over the budget: headers, the stack and open frames count */
+    {
+        static const char *const shapes[][3] = {
+            { "", "[", "" },
+            { "[", "\"\",", "\"\"]" },
+            { "{", "\"k\":0,", "\"k\":0}" },
+            { "[", "{\"a\":1},", "{\"a\":1}]" }
+        };
+        size_t i, j, n = 100000;
+        for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+            test_heap heap = { 0, 0, 0, 0 };
+            lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+            size_t unit = strlen(shapes[i][1]);
+            char *json = (char *)malloc(strlen(shapes[i][0]) + n * unit + strlen(shapes[i][2]) + 1);
+            char *q = json + strlen(strcpy(json, shapes[i][0]));
+            for (j = 0; j < n; ++j, q += unit)
+                memcpy(q, shapes[i][1], unit);
+            strcpy(q, shapes[i][2]);
+            a.user = &heap;
+            memset(&opt, 0, sizeof(opt));
+            opt.allocator = &a;
+            opt.max_depth = 1000000;
+            opt.max_bytes = 65536;
+            EXPECT_EQ_INT(LEPT_PARSE_TOO_MUCH_MEMORY, lept_parse_ex(&v, json, &opt));
+            EXPECT_EQ_TRUE(heap.peak <= 65536);
+            EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+            free(json);
+        }
+    }
+}
+
+static void test_reuse() {
+    test_heap heap = { 0, 0, 0, 0 };
+    lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+    const char *json = "{\"a\":[1,2,{\"b\":\"xyz\"}],\"c\":\"\\u4e2d\"}";
+    const char *path = "/a/b", *out, *out2;
+    lept_parse_options opt;
+    lept_parser *p;
+    lept_serializer *s;
+    lept_value v, expect;
+    size_t length, calls;
+    a.user = &heap;
+    memset(&opt, 0, sizeof(opt));
+    lept_init(&v);
+    lept_init(&expect);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, json));
+
+    p = lept_parser_create(&a, 4096);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, json, NULL));
+    EXPECT_EQ_TRUE(lept_is_equal(&expect, &v));
+    lept_free(&v);
+    calls = heap.calls;
+    /* warm: no more allocations for the parser itself */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, json, NULL));
+    EXPECT_EQ_SIZE_T(calls, heap.calls);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parser_parse(p, &v, "[1 2]", NULL));
+    opt.paths = &path;
+    opt.path_count = 1;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, json, &opt));
+    EXPECT_EQ_SIZE_T((size_t)1, lept_get_object_size(&v));
+    EXPECT_EQ_SIZE_T((size_t)1, lept_get_array_size(lept_get_object_value(&v, 0)));
+    lept_free(&v);
+    calls = heap.calls;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, json, &opt));
+    EXPECT_EQ_SIZE_T(calls, heap.calls);
+    lept_free(&v);
+    lept_parser_destroy(p);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+
+    /* nothing retained: every call starts cold */
+    p = lept_parser_create(&a, 0);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, json, NULL));
+    lept_free(&v);
+    EXPECT_EQ_SIZE_T((size_t)1, heap.blocks);
+    lept_parser_destroy(p);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+
+    s = lept_serializer_create(&a, 4096);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_serializer_write(s, &expect, &out, &length, NULL));
+    EXPECT_EQ_SIZE_T(strlen(out), length);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, out));
+    EXPECT_EQ_TRUE(lept_is_equal(&expect, &v));
+    lept_free(&v);
+    calls = heap.calls;
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_serializer_write(s, &expect, &out2, &length, NULL));
+    EXPECT_EQ_TRUE(out == out2);
+    EXPECT_EQ_SIZE_T(calls, heap.calls);
+    lept_serializer_destroy(s);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    lept_free(&expect);
+}
+
+static void test_stream() {
+    static const char *chunks[] = { "{\"a\":[1,", "2]}\n\"x\\u4e", "2d\" 12", "3 tr", "ue\n" };
+    static const lept_parse_options end_options = { LEPT_PARSE_STREAM_END, NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+    static const lept_parse_options utf8_options = { LEPT_PARSE_VALIDATE_UTF8, NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+    const char *json = "{\"a\":1}[2]\"s\"\n 3 null";
+    char buffer[64];
+    lept_parser *p = lept_parser_create(NULL, 4096);
+    lept_value v;
+    size_t offset = 0, len = 0, i, count = 0;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, json, strlen(json), &offset, NULL));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+    EXPECT_EQ_SIZE_T((size_t)7, offset);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, json, strlen(json), &offset, NULL));
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+    EXPECT_EQ_SIZE_T((size_t)10, offset);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, json, strlen(json), &offset, NULL));
+    EXPECT_EQ_STRING("s", lept_get_string(&v), lept_get_string_length(&v));
+    EXPECT_EQ_SIZE_T((size_t)13, offset);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, json, strlen(json), &offset, NULL));
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(&v));
+    EXPECT_EQ_SIZE_T((size_t)16, offset);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, json, strlen(json), &offset, NULL));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_INCOMPLETE, lept_parser_next(p, &v, json, strlen(json), &offset, NULL));
+    EXPECT_EQ_SIZE_T(strlen(json), offset);
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE,
+                  lept_parser_next(p, &v, json, strlen(json), &offset, &end_options));
+
+    /* refilling after each partial document */
+    offset = 0;
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        int ret;
+        memmove(buffer, buffer + offset, len - offset);
+        len -= offset;
+        offset = 0;
+        memcpy(buffer + len, chunks[i], strlen(chunks[i]) + 1);
+        len += strlen(chunks[i]);
+        while ((ret = lept_parser_next(p, &v, buffer, len, &offset, NULL)) == LEPT_PARSE_OK) {
+            switch (count++) {
+                case 0: EXPECT_EQ_SIZE_T((size_t)1, lept_get_object_size(&v)); break;
+                case 1: EXPECT_EQ_STRING("x\xE4\xB8\xAD", lept_get_string(&v), lept_get_string_length(&v)); break;
+                case 2: EXPECT_EQ_DOUBLE(123.0, lept_get_number(&v)); break;
+                case 3: EXPECT_EQ_INT(LEPT_TRUE, lept_get_type(&v)); break;
+            }
+            lept_free(&v);
+        }
+        EXPECT_EQ_INT(LEPT_PARSE_INCOMPLETE, ret);
+    }
+    EXPECT_EQ_SIZE_T((size_t)4, count);
+    EXPECT_EQ_SIZE_T(len, offset);
+
+    /* truncation only counts when the input runs out */
+    offset = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_INCOMPLETE, lept_parser_next(p, &v, "[1, \"\\u00", 9, &offset, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_QUOTATION_MARK,
+                  lept_parser_next(p, &v, "\"abc", 4, &offset, &end_options));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, "12", 2, &offset, &end_options));
+    EXPECT_EQ_DOUBLE(12.0, lept_get_number(&v));
+    offset = 1;
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
+                  lept_parser_next(p, &v, " [1 2", 5, &offset, NULL));
+    EXPECT_EQ_SIZE_T((size_t)1, offset);
+    offset = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UNICODE_HEX, lept_parser_next(p, &v, "\"\\u0G", 5, &offset, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_INCOMPLETE, lept_parser_next(p, &v, "\"a\xE4\xB8", 4, &offset, &utf8_options));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UTF8, lept_parser_next(p, &v, "\"a\xE4\"", 4, &offset, &utf8_options));
+
+    /* a number ends where its grammar does, even right before another one */
+    offset = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, "-01", 3, &offset, &end_options));
+    EXPECT_EQ_DOUBLE(0.0, lept_get_number(&v));
+    EXPECT_EQ_TRUE(1.0 / lept_get_number(&v) < 0);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, "-01", 3, &offset, &end_options));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(&v));
+    offset = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_next(p, &v, "-0x1", 4, &offset, &end_options));
+    EXPECT_EQ_DOUBLE(0.0, lept_get_number(&v));
+    EXPECT_EQ_SIZE_T((size_t)2, offset);
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parser_next(p, &v, "-0x1", 4, &offset, &end_options));
+    for (i = 0; i < 2; ++i) {
+        const char *numbers = "1.5-2.5 -01e1";
+        static const char *expect[] = { "1.5", "-2.5", "-0", "1e1" };
+        lept_parse_options opt = { LEPT_PARSE_STREAM_END, NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+        size_t j;
+        if (i == 1)
+            opt.flags |= LEPT_PARSE_LAZY_NUMBERS;
+        offset = 0;
+        for (j = 0; j < 4; ++j) {
+            char *out;
+            size_t length;
+            EXPECT_EQ_INT(LEPT_PARSE_OK,
+                          lept_parser_next(p, &v, numbers, strlen(numbers), &offset, &opt));
+            EXPECT_EQ_DOUBLE(strtod(expect[j], NULL), lept_get_number(&v));
+            if (i == 1) {
+                EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &out, &length));
+                EXPECT_EQ_STRING(expect[j], out, length);
+                free(out);
+            }
+            lept_free(&v);
+        }
+        EXPECT_EQ_SIZE_T(strlen(numbers), offset);
+    }
+    lept_parser_destroy(p);
+}
+
+#define EXPECT_WRITE_SAME(s, v) \
+    do { \
+        const char *out; \
+        char *expect; \
+        size_t length, expect_length; \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_serializer_write(s, v, &out, &length, NULL)); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(v, &expect, &expect_length)); \
+        EXPECT_EQ_STRING(expect, out, length); \
+        free(expect); \
+    } while(0)
+
+static void test_incremental() {
+    test_heap heap = { 0, 0, 0, 0 };
+    lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+    lept_serializer *s;
+    lept_value v, w, *e;
+    a.user = &heap;
+    lept_init(&v);
+    lept_init(&w);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v,
+        "{\"a\":{\"b\":[1,\"x\",{\"c\":true}],\"d\":\"y\"},\"e\":[[1,2],[]]}"));
+    s = lept_serializer_create(&a, 0);
+    lept_serializer_set_incremental(s, 1);
+    EXPECT_WRITE_SAME(s, &v);
+    EXPECT_WRITE_SAME(s, &v);
+
+    e = lept_serializer_touch(s, &v, "/a/b/1");
+    EXPECT_EQ_INT(LEPT_STRING, lept_get_type(e));
+    lept_set_string(e, "zz", 2);
+    EXPECT_WRITE_SAME(s, &v);
+
+    /* a whole subtree written again, then edited below */
+    e = lept_serializer_touch(s, &v, "/e/0");
+    lept_free(e);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(e, "{\"k\":[null,{}],\"m\":{}}"));
+    EXPECT_WRITE_SAME(s, &v);
+    lept_set_boolean(lept_serializer_touch(s, &v, "/e/0/k/0"), 1);
+    EXPECT_WRITE_SAME(s, &v);
+    lept_set_number(lept_serializer_touch(s, &v, "/a/b/2/c"), 0.5);
+    lept_set_int64(lept_serializer_touch(s, &v, "/e/0/k/1"), -3);
+    EXPECT_WRITE_SAME(s, &v);
+    EXPECT_WRITE_SAME(s, &v);
+
+    EXPECT_EQ_TRUE(lept_serializer_touch(s, &v, "/f") == NULL);
+    EXPECT_EQ_TRUE(lept_serializer_touch(s, &v, "/e/9") == NULL);
+    EXPECT_EQ_TRUE(lept_serializer_touch(s, &v, "e") == NULL);
+    e = lept_serializer_touch(s, &v, "");
+    EXPECT_EQ_TRUE(e == &v);
+    lept_free(e);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(e, "[\"q\",[[]]]"));
+    EXPECT_WRITE_SAME(s, &v);
+
+    /* so does the same variable freed and parsed into without a touch */
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[\"r\",[[]]]"));
+    EXPECT_WRITE_SAME(s, &v);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":{\"b\":2},\"e\":[]}"));
+    EXPECT_WRITE_SAME(s, &v);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":{\"b\":3},\"e\":[]}"));
+    EXPECT_WRITE_SAME(s, &v);
+
+    /* another value starts over */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&w, "[{\"p\":1}]"));
+    EXPECT_WRITE_SAME(s, &w);
+    lept_set_null(lept_serializer_touch(s, &w, "/0/p"));
+    EXPECT_WRITE_SAME(s, &w);
+    EXPECT_WRITE_SAME(s, &v);
+
+    lept_serializer_set_incremental(s, 0);
+    EXPECT_WRITE_SAME(s, &v);
+    lept_serializer_destroy(s);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    lept_free(&v);
+    lept_free(&w);
+}
+
+static void test_doc() {
+    test_heap heap = { 0, 0, 0, 0 };
+    lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+    const char *json = "{\"a\":{\"b\":[1,\"x\",{\"c\":true}],\"d\":\"y\"},\"e/f\":[]}";
+    lept_parse_options opt;
+    lept_doc *d, *d2, *d3, *sub;
+    lept_value v, n;
+    size_t blocks;
+    a.user = &heap;
+    memset(&opt, 0, sizeof(opt));
+    opt.allocator = &a;
+    lept_init(&v);
+    lept_init(&n);
+
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_doc_parse(&d, "[1 2]", &opt));
+    EXPECT_EQ_TRUE(d == NULL);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_doc_parse(&d, json, &opt));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_EQ_TRUE(lept_is_equal(&v, lept_doc_root(d)));
+    EXPECT_EQ_TRUE(lept_doc_find(d, "") == lept_doc_root(d));
+    EXPECT_EQ_STRING("x", lept_get_string(lept_doc_find(d, "/a/b/1")), 1);
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(lept_doc_find(d, "/e~1f")));
+    EXPECT_EQ_TRUE(lept_doc_find(d, "/a/b/3") == NULL);
+    EXPECT_EQ_TRUE(lept_doc_find(d, "/a/b/01") == NULL);
+    EXPECT_EQ_TRUE(lept_doc_find(d, "/a/d/0") == NULL);
+    EXPECT_EQ_TRUE(lept_doc_find(d, "a") == NULL);
+
+    /* sharing allocates nothing, and a subtree outlives its document */
+    blocks = heap.blocks;
+    EXPECT_EQ_TRUE(lept_doc_retain(d) == d);
+    lept_doc_release(d);
+    sub = lept_doc_subtree(d, "/a/b");
+    EXPECT_EQ_SIZE_T(blocks + 1, heap.blocks);
+    EXPECT_EQ_TRUE(lept_get_array_element(lept_doc_root(sub), 0) ==
+                   lept_get_array_element(lept_doc_find(d, "/a/b"), 0));
+    EXPECT_EQ_TRUE(lept_doc_subtree(d, "/z") == NULL);
+
+    /* edits copy the path only; the old document is untouched */
+    lept_set_number(&n, 2.0);
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_set(&d2, d, "/a/b/0", &n));
+    EXPECT_EQ_DOUBLE(2.0, lept_get_number(lept_doc_find(d2, "/a/b/0")));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_doc_find(d, "/a/b/0")));
+    EXPECT_EQ_TRUE(lept_is_equal(&v, lept_doc_root(d)));
+    EXPECT_EQ_TRUE(lept_doc_find(d2, "/a/b") != lept_doc_find(d, "/a/b"));
+    EXPECT_EQ_TRUE(lept_get_string(lept_doc_find(d2, "/a/d")) ==
+                   lept_get_string(lept_doc_find(d, "/a/d")));
+    EXPECT_EQ_TRUE(lept_get_object_value(lept_doc_find(d2, "/a/b/2"), 0) ==
+                   lept_get_object_value(lept_doc_find(d, "/a/b/2"), 0));
+
+    lept_set_string(&n, "z", 1);
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_set(&d3, d2, "/a/g", &n));
+    EXPECT_EQ_STRING("z", lept_get_string(lept_doc_find(d3, "/a/g")), 1);
+    EXPECT_EQ_TRUE(lept_doc_find(d2, "/a/g") == NULL);
+    lept_doc_release(d2);
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_set(&d2, d3, "/e~1f/-", &n));
+    EXPECT_EQ_SIZE_T((size_t)1, lept_get_array_size(lept_doc_find(d2, "/e~1f")));
+    EXPECT_EQ_SIZE_T((size_t)0, lept_get_array_size(lept_doc_find(d3, "/e~1f")));
+    lept_doc_release(d3);
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_remove(&d3, d2, "/a/b/1"));
+    EXPECT_EQ_SIZE_T((size_t)2, lept_get_array_size(lept_doc_find(d3, "/a/b")));
+    EXPECT_EQ_TRUE(lept_get_boolean(lept_doc_find(d3, "/a/b/1/c")));
+    EXPECT_EQ_SIZE_T((size_t)3, lept_get_array_size(lept_doc_find(d2, "/a/b")));
+    lept_doc_release(d3);
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_set(&d3, d2, "", &n));
+    EXPECT_EQ_INT(LEPT_STRING, lept_get_type(lept_doc_root(d3)));
+    lept_doc_release(d3);
+
+    EXPECT_EQ_INT(LEPT_POINTER_INVALID, lept_doc_set(&d3, d2, "a", &n));
+    EXPECT_EQ_TRUE(d3 == NULL);
+    EXPECT_EQ_INT(LEPT_POINTER_NOT_FOUND, lept_doc_set(&d3, d2, "/x/y", &n));
+    EXPECT_EQ_INT(LEPT_POINTER_NOT_FOUND, lept_doc_set(&d3, d2, "/a/b/7", &n));
+    EXPECT_EQ_INT(LEPT_POINTER_NOT_FOUND, lept_doc_set(&d3, d2, "/a/d/0", &n));
+    EXPECT_EQ_INT(LEPT_POINTER_NOT_FOUND, lept_doc_remove(&d3, d2, "/a/x"));
+    EXPECT_EQ_INT(LEPT_POINTER_INVALID, lept_doc_remove(&d3, d2, ""));
+
+    lept_doc_release(d2);
+    lept_doc_release(d);
+    EXPECT_EQ_INT(1, lept_get_boolean(lept_doc_find(sub, "/2/c")));
+    lept_doc_release(sub);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+
+    /* the default allocator works the same */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_doc_parse(&d, json, NULL));
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_remove(&d2, d, "/a"));
+    EXPECT_EQ_SIZE_T((size_t)1, lept_get_object_size(lept_doc_root(d2)));
+    EXPECT_EQ_TRUE(lept_is_equal(&v, lept_doc_root(d)));
+    lept_doc_release(d);
+    lept_doc_release(d2);
+    lept_free(&v);
+    lept_free(&n);
+}
+
+static void test_pack() {
+    test_heap heap = { 0, 0, 0, 0 };
+    lept_allocator a = { test_malloc, test_realloc, test_free, NULL };
+    const char *json = "[[1,2,-3],[1.5,-2,3e2],[1,\"x\"],[9007199254740993,0.5],"
+                       "[9223372036854775807,-1],[],{\"a\":[0.5,-0.0]}]";
+    const int64_t *ints;
+    const double *doubles;
+    lept_parse_options opt;
+    lept_value v, e, c;
+    lept_doc *d, *d2;
+    char *out, *expect;
+    size_t n, length;
+    a.user = &heap;
+    memset(&opt, 0, sizeof(opt));
+    opt.flags = LEPT_PARSE_PACK_NUMBERS;
+    lept_init(&v);
+    lept_init(&e);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, json));
+    EXPECT_EQ_TRUE((ints = lept_get_array_int64s(lept_get_array_element(&v, 0), &n)) != NULL);
+    EXPECT_EQ_SIZE_T((size_t)3, n);
+    EXPECT_EQ_TRUE(ints[0] == 1 && ints[1] == 2 && ints[2] == -3);
+    EXPECT_EQ_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 0), &n) == NULL);
+    EXPECT_EQ_TRUE((doubles = lept_get_array_doubles(lept_get_array_element(&v, 1), &n)) != NULL);
+    EXPECT_EQ_SIZE_T((size_t)3, n);
+    EXPECT_EQ_DOUBLE(-2.0, doubles[1]);
+    EXPECT_EQ_DOUBLE(300.0, doubles[2]);
+    /* not only numbers, or not exact as doubles */
+    EXPECT_EQ_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 2), &n) == NULL);
+    EXPECT_EQ_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 3), &n) == NULL);
+    EXPECT_EQ_TRUE(lept_get_array_int64s(lept_get_array_element(&v, 3), &n) == NULL);
+    EXPECT_EQ_TRUE((ints = lept_get_array_int64s(lept_get_array_element(&v, 4), &n)) != NULL);
+    EXPECT_EQ_TRUE(ints[0] == INT64_MAX);
+    EXPECT_EQ_TRUE(lept_get_array_int64s(lept_get_array_element(&v, 5), &n) == NULL);
+
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &out, &length));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&e, &expect, &n));
+    EXPECT_EQ_STRING(expect, out, length);
+    free(out);
+    free(expect);
+    EXPECT_EQ_TRUE(lept_is_equal(&v, &e));
+    EXPECT_EQ_TRUE(lept_is_equal(&e, &v));
+    EXPECT_EQ_TRUE(lept_hash(&v) == lept_hash(&e));
+    lept_copy(&c, &v);
+    EXPECT_EQ_TRUE(lept_get_array_int64s(lept_get_array_element(&c, 0), &n) != NULL);
+    EXPECT_EQ_TRUE(lept_is_equal(&c, &v));
+    lept_unpack_array(lept_get_object_value(lept_get_array_element(&c, 6), 0));
+    lept_set_number(lept_get_array_element(lept_get_object_value(lept_get_array_element(&c, 6), 0), 1), 1.0);
+    EXPECT_EQ_FALSE(lept_is_equal(&c, &v));
+    lept_free(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&c, "{\"a\":[0.5,0]}", &opt));
+    EXPECT_EQ_TRUE(lept_is_equal(&c, lept_get_array_element(&v, 6)));
+    lept_free(&c);
+
+    /* peeking at an element leaves the array packed, only unpacking changes it */
+    EXPECT_EQ_DOUBLE(-2.0, lept_get_number(lept_peek_array_element(lept_get_array_element(&v, 1), 1, &c)));
+    EXPECT_EQ_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 1), &n) != NULL);
+    EXPECT_EQ_INT(LEPT_NUMBER_INT64,
+                  lept_get_number_type(lept_peek_array_element(lept_get_array_element(&v, 0), 2, &c)));
+    EXPECT_EQ_TRUE(lept_peek_array_element(&v, 2, &c) == lept_get_array_element(&v, 2));
+    lept_unpack_array(lept_get_array_element(&v, 1));
+    lept_unpack_array(lept_get_array_element(&v, 1));
+    EXPECT_EQ_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 1), &n) == NULL);
+    EXPECT_EQ_DOUBLE(-2.0, lept_get_number(lept_get_array_element(lept_get_array_element(&v, 1), 1)));
+    EXPECT_EQ_TRUE(lept_is_equal(&v, &e));
+    lept_init(&c);
+
+    /* shared documents never hold packed arrays */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_doc_parse(&d, json, &opt));
+    EXPECT_EQ_TRUE(lept_get_array_int64s(lept_doc_find(d, "/4"), &n) == NULL);
+    EXPECT_EQ_INT(LEPT_POINTER_OK, lept_doc_set(&d2, d, "/0", lept_get_array_element(&v, 4)));
+    EXPECT_EQ_TRUE(lept_get_array_int64s(lept_doc_find(d2, "/0"), &n) == NULL);
+    EXPECT_EQ_TRUE(lept_is_equal(lept_doc_find(d2, "/0"), lept_get_array_element(&v, 4)));
+    lept_doc_release(d);
+    lept_doc_release(d2);
+    lept_free(&v);
+    lept_free(&e);
+
+    opt.allocator = &a;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt));
+    EXPECT_EQ_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 1), &n) != NULL);
+    lept_unpack_array(lept_get_array_element(&v, 1));
+    lept_free(&v);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.blocks);
+    EXPECT_EQ_SIZE_T((size_t)0, heap.bytes);
+}
+
 static void test_parse() {
     test_parse_null();
     test_parse_true();
     test_parse_false();
     test_parse_number();
+    test_parse_integer();
+    test_parse_lazy_numbers();
+    test_parse_shape();
     test_parse_expect_value();
     test_parse_invalid_value();
     test_parse_root_not_singular();
@@ -376,6 +1411,19 @@ static void test_parse() {
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
     test_parse_object();
+    test_parse_projection();
+    test_validate();
+    test_parse_utf8();
+    test_parse_nesting();
+    test_stats();
+    test_allocator();
+    test_reclaim();
+    test_limits();
+    test_reuse();
+    test_stream();
+    test_incremental();
+    test_doc();
+    test_pack();
 
     test_access_string();
     test_access_boolean();
@@ -389,13 +1437,20 @@ static void test_parse() {
         char *json2; \
         size_t len; \
         EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json)); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, strlen(json), NULL)); \
         EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &json2, &len)); \
         EXPECT_EQ_STRING(json, json2, len); \
+        free(json2); \
         lept_free(&v); \
     } while(0)
 
 static void test_stringify_number() {
     TEST_ROUNDTRIP("0");
+    TEST_ROUNDTRIP("12345678901234567");
+    TEST_ROUNDTRIP("-9223372036854775808");
+    TEST_ROUNDTRIP("9223372036854775807");
+    TEST_ROUNDTRIP("18446744073709551615");
+    TEST_ROUNDTRIP("[10,99,100,-7,1000000000000000000]");
     TEST_ROUNDTRIP("-0");
     TEST_ROUNDTRIP("1");
     TEST_ROUNDTRIP("-1");
@@ -435,6 +1490,239 @@ static void test_stringify_string() {
     TEST_ROUNDTRIP("\"Hello\\u0000World\"");
 }
 
+#define TEST_BUFFER(json, parse_flags) \
+    do { \
+        test_heap heap = { 0, 0, 0, 0 }; \
+        lept_allocator a = { test_malloc, test_realloc, test_free, NULL }; \
+        lept_parse_options opt; \
+        lept_stringify_options sopt; \
+        lept_value v; \
+        char *expect, *buffer; \
+        size_t length, expect_length; \
+        a.user = &heap; \
+        memset(&opt, 0, sizeof(opt)); \
+        memset(&sopt, 0, sizeof(sopt)); \
+        opt.flags = parse_flags; \
+        sopt.allocator = &a; \
+        lept_init(&v); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt)); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &expect, &expect_length)); \
+        EXPECT_EQ_SIZE_T(expect_length, lept_stringify_length(&v)); \
+        buffer = (char *)malloc(expect_length + 1); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, \
+                      lept_stringify_buffer(&v, buffer, expect_length + 1, &length, &sopt)); \
+        EXPECT_EQ_SIZE_T(expect_length, length); \
+        EXPECT_EQ_STRING(expect, buffer, length); \
+        EXPECT_EQ_SIZE_T((size_t)0, heap.calls); \
+        memset(buffer, 'x', expect_length + 1); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_BUFFER_TOO_SMALL, \
+                      lept_stringify_buffer(&v, buffer, expect_length, &length, &sopt)); \
+        EXPECT_EQ_SIZE_T(expect_length, length); \
+        EXPECT_EQ_STRING(expect, buffer, expect_length - 1); \
+        EXPECT_EQ_INT('\0', buffer[expect_length - 1]); \
+        EXPECT_EQ_INT('x', buffer[expect_length]); \
+        EXPECT_EQ_SIZE_T((size_t)0, heap.blocks); \
+        free(buffer); \
+        free(expect); \
+        lept_free(&v); \
+    } while(0)
+
+static void test_stringify_buffer() {
+    lept_value v;
+    size_t length = 0;
+    TEST_BUFFER("null", 0);
+    TEST_BUFFER("-1.5e-10", 0);
+    TEST_BUFFER("-1.5e-10", LEPT_PARSE_LAZY_NUMBERS);
+    TEST_BUFFER("[18446744073709551615,-9223372036854775808,0.1]", 0);
+    TEST_BUFFER("[1,-2,3000000000]", LEPT_PARSE_PACK_NUMBERS);
+    TEST_BUFFER("[0.5,1e300,-2]", LEPT_PARSE_PACK_NUMBERS);
+    TEST_BUFFER("\"\\\" \\\\ \\b \\f \\n \\r \\t \\u0001 \\u001F \\u4E2D\"", 0);
+    TEST_BUFFER("{\"a\\n\":[],\"b\":{},\"c\":[1,{\"d\":null,\"e\":[true,false]}]}", 0);
+    TEST_BUFFER("[\"a long string that is much shorter than six times its length allows\"]", 0);
+
+    /* size 0 only measures */
+    lept_init(&v);
+    lept_set_string(&v, "abc", 3);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_BUFFER_TOO_SMALL, lept_stringify_buffer(&v, NULL, 0, &length, NULL));
+    EXPECT_EQ_SIZE_T((size_t)5, length);
+    lept_free(&v);
+
+    /* buffers of a few bytes keep what fits */
+    for (size_t size = 1; size <= 3; ++size) {
+        static const char *json[] = { "true", "-1.5", "\"abc\"", "[1,2]" };
+        char buffer[4];
+        for (size_t i = 0; i < sizeof(json) / sizeof(json[0]); ++i) {
+            EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json[i]));
+            memset(buffer, 'x', sizeof(buffer));
+            EXPECT_EQ_INT(LEPT_STRINGIFY_BUFFER_TOO_SMALL,
+                          lept_stringify_buffer(&v, buffer, size, &length, NULL));
+            EXPECT_EQ_SIZE_T(strlen(json[i]), length);
+            EXPECT_EQ_STRING(json[i], buffer, size - 1);
+            EXPECT_EQ_TRUE(buffer[size - 1] == '\0' && buffer[size] == 'x');
+            lept_free(&v);
+        }
+    }
+}
+
+static void test_equal() {
+    const char *json[] = {
+        "null", "true", "1.5", "\"a\\u0000b\"", "[]", "{}", "[1,[2,{\"a\":[]}]]",
+        "{\"a\":1,\"b\":[true,{}]}", "{\"a\":1,\"c\":[true,{}]}", "[1,[2,{\"a\":[null]}]]"
+    };
+    size_t n = sizeof(json) / sizeof(json[0]);
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j) {
+            lept_value a, b;
+            lept_init(&a);
+            lept_init(&b);
+            EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, json[i]));
+            EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, json[j]));
+            EXPECT_EQ_INT(i == j, lept_is_equal(&a, &b));
+            /* the same with the hashes cached */
+            EXPECT_EQ_INT(i == j, lept_hash(&a) == lept_hash(&b));
+            EXPECT_EQ_INT(i == j, lept_is_equal(&a, &b));
+            lept_free(&a);
+            lept_free(&b);
+        }
+}
+
+static void test_equal_unordered() {
+    const char *same[][2] = {
+        { "{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":1}" },
+        { "[{\"x\":[1,{\"p\":null,\"q\":\"s\"}],\"y\":{}}]", "[{\"y\":{},\"x\":[1,{\"q\":\"s\",\"p\":null}]}]" },
+        { "{\"a\":1,\"a\":2,\"b\":0}", "{\"b\":0,\"a\":1,\"a\":2}" },
+        { "{\"ab\":0,\"a\":1,\"\":2}", "{\"\":2,\"a\":1,\"ab\":0}" },
+        { "-0", "0" }
+    };
+    const char *differ[][2] = {
+        { "{\"a\":1,\"b\":2}", "{\"b\":1,\"a\":2}" },
+        { "{\"a\":1,\"a\":1}", "{\"a\":1,\"b\":1}" },
+        { "{\"a\":1,\"a\":2}", "{\"a\":2,\"a\":1}" },
+        { "[1,2]", "[2,1]" },
+        { "{\"a\":[1,2]}", "{\"a\":[1,3]}" }
+    };
+    lept_value a, b;
+    size_t i;
+    lept_init(&a);
+    lept_init(&b);
+    for (i = 0; i < sizeof(same) / sizeof(same[0]); ++i) {
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, same[i][0]));
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, same[i][1]));
+        EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+        EXPECT_EQ_TRUE(lept_hash(&a) == lept_hash(&b));
+        EXPECT_EQ_TRUE(lept_is_equal(&b, &a));
+        lept_free(&a);
+        lept_free(&b);
+    }
+    for (i = 0; i < sizeof(differ) / sizeof(differ[0]); ++i) {
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, differ[i][0]));
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, differ[i][1]));
+        EXPECT_EQ_FALSE(lept_is_equal(&a, &b));
+        lept_hash(&a);
+        lept_hash(&b);
+        EXPECT_EQ_FALSE(lept_is_equal(&b, &a));
+        lept_free(&a);
+        lept_free(&b);
+    }
+}
+
+static void test_hash() {
+    lept_value a, b, c;
+    uint32_t h;
+    lept_init(&a);
+    lept_init(&b);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "{\"a\":[1,\"x\"],\"b\":{\"c\":true}}"));
+    h = lept_hash(&a);
+    EXPECT_EQ_TRUE(h != 0);
+    EXPECT_EQ_TRUE(h == lept_hash(&a));
+    /* copies keep the cached hashes */
+    lept_copy(&b, &a);
+    EXPECT_EQ_TRUE(h == b.hash);
+    EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+
+    /* in-place changes need the ancestors' hashes cleared */
+    lept_set_number(lept_get_array_element(lept_get_object_value(&b, 0), 0), 2.0);
+    lept_hash_clear(&b);
+    EXPECT_EQ_TRUE(h != lept_hash(&b));
+    EXPECT_EQ_FALSE(lept_is_equal(&a, &b));
+    lept_set_number(lept_get_array_element(lept_get_object_value(&b, 0), 0), 1.0);
+    lept_hash_clear(&b);
+    EXPECT_EQ_TRUE(h == lept_hash(&b));
+    EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+    lept_free(&a);
+    lept_free(&b);
+
+    /* hashed documents that differ are told apart by their cached hashes alone */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "[{\"a\":1},[1,2]]"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, "[{\"a\":1},[1,2]]"));
+    lept_copy(&c, &a);
+    EXPECT_EQ_TRUE(lept_hash(&a) == lept_hash(&b));
+    EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+    a.hash = b.hash + 1;
+    EXPECT_EQ_FALSE(lept_is_equal(&a, &b));
+    lept_get_array_element(&b, 1)->hash = 1;
+    lept_get_array_element(&c, 1)->hash = 2;
+    EXPECT_EQ_FALSE(lept_is_equal(&c, &b));
+    lept_hash_clear(&a);
+    lept_hash_clear(&b);
+    EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+    EXPECT_EQ_TRUE(lept_is_equal(&c, &b));
+
+    /* and with lept_hash_clear after changing one in place, only those */
+    lept_hash(&a);
+    lept_set_number(lept_get_array_element(lept_get_array_element(&a, 1), 1), 3.0);
+    lept_hash_clear(&a);
+    EXPECT_EQ_FALSE(lept_is_equal(&a, &b));
+    lept_set_number(lept_get_array_element(lept_get_array_element(&a, 1), 1), 2.0);
+    lept_hash_clear(&a);
+    lept_hash(&a);
+    EXPECT_EQ_TRUE(lept_is_equal(&a, &b));
+    lept_free(&a);
+    lept_free(&b);
+    lept_free(&c);
+}
+
+static void test_copy() {
+    lept_value v, c;
+    lept_init(&v);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":[1,\"s\",{\"b\":[]}],\"\":null}"));
+    lept_set_string(&c, "old", 3);
+    lept_copy(&c, &v);
+    EXPECT_EQ_TRUE(lept_is_equal(&v, &c));
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&c));
+    EXPECT_EQ_SIZE_T((size_t)2, lept_get_object_size(&c));
+    EXPECT_EQ_STRING("s", lept_get_string(lept_get_array_element(lept_get_object_value(&c, 0), 1)),
+                     lept_get_string_length(lept_get_array_element(lept_get_object_value(&c, 0), 1)));
+    lept_free(&c);
+}
+
+/* none of the tree walks may recurse on the C stack */
+static void test_deep() {
+    lept_parse_options opt;
+    lept_value v, c;
+    char *json, *json2;
+    size_t length;
+    memset(&opt, 0, sizeof(opt));
+    opt.max_depth = 200000;
+    json = nested("{\"a\":[", "]}", 100000);
+    lept_init(&v);
+    lept_init(&c);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &opt));
+    lept_copy(&c, &v);
+    EXPECT_EQ_TRUE(lept_is_equal(&v, &c));
+    EXPECT_EQ_TRUE(lept_hash(&v) == lept_hash(&c));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&c, &json2, &length));
+    EXPECT_EQ_SIZE_T(strlen(json), length);
+    EXPECT_EQ_STRING(json, json2, length);
+    lept_free(&v);
+    lept_free(&c);
+    free(json);
+    free(json2);
+}
+
 static void test_stringify() {
     TEST_ROUNDTRIP("null");
     TEST_ROUNDTRIP("true");
@@ -443,6 +1731,12 @@ static void test_stringify() {
     test_stringify_string();
     test_stringify_array();
     test_stringify_object();
+    test_stringify_buffer();
+    test_equal();
+    test_equal_unordered();
+    test_hash();
+    test_copy();
+    test_deep();
 }
 
 int main() {
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "leptjson.hpp"
+
+static int main_ret = 0;
+static int test_count = 0;
+static int test_pass = 0;
+
+#define EXPECT_EQ_BASE(equality, expect, actual, format) \
+    do { \
+        ++test_count; \
+        if(equality) { \
+            ++test_pass; \
+        } else { \
+            fprintf(stderr, "%s:%d: expect: " format " actual: " format "\n", \
+                    __FILE__, __LINE__, expect, actual); \
+            main_ret = 1; \
+        } \
+    } while(0)
+
+#define EXPECT_EQ_INT(expect, actual) \
+        EXPECT_EQ_BASE((expect) == (actual), (int)(expect), (int)(actual), "%d")
+#define EXPECT_EQ_DOUBLE(expect, actual) \
+        EXPECT_EQ_BASE((expect) == (actual), (double)(expect), (double)(actual), "%f")
+#define EXPECT_EQ_TRUE(actual) \
+    do { EXPECT_EQ_BASE((actual), "true", "false", "%s"); } while(0)
+#define EXPECT_EQ_FALSE(actual) \
+    do { EXPECT_EQ_BASE(!(actual), "false", "true", "%s"); } while(0)
+#define EXPECT_EQ_VIEW(expect, actual) \
+    do { \
+        std::string e(expect), a(actual); \
+        EXPECT_EQ_BASE(e == a, e.c_str(), a.c_str(), "%s"); \
+    } while(0)
+
+static_assert(!std::is_copy_constructible<lept::Value>::value, "Value copies only by copy()");
+static_assert(!std::is_copy_assignable<lept::Document>::value, "Document copies only by copy()");
+static_assert(std::is_nothrow_move_constructible<lept::Document>::value, "Document moves");
+
+static void test_access() {
+    lept::Document doc("{\"a\":[1,\"x\\u4e2d\",true,null],\"b\":{\"c\":-2.5},\"d\":\"\"}");
+    EXPECT_EQ_TRUE(doc.ok());
+    EXPECT_EQ_INT(LEPT_OBJECT, doc.type());
+    EXPECT_EQ_INT(3, doc.size());
+    EXPECT_EQ_INT(4, doc["a"].size());
+    EXPECT_EQ_INT(1, doc["a"][0].int64());
+    EXPECT_EQ_VIEW("x\xE4\xB8\xAD", doc["a"][1].string());
+    EXPECT_EQ_TRUE(doc["a"][2].boolean());
+    EXPECT_EQ_TRUE(doc["a"][3].is_null());
+    EXPECT_EQ_DOUBLE(-2.5, doc["b"]["c"].number());
+    EXPECT_EQ_VIEW("", doc["d"].string());
+    EXPECT_EQ_FALSE(doc["e"]);
+    EXPECT_EQ_FALSE(doc["e"]["f"]);
+    EXPECT_EQ_FALSE(doc["a"]["f"]);
+    /* a missing index, or an index into anything but an array, is a false Ref too */
+    EXPECT_EQ_FALSE(doc["e"][0]);
+    EXPECT_EQ_FALSE(doc["a"][4]);
+    EXPECT_EQ_FALSE(doc["b"][0]);
+    EXPECT_EQ_FALSE(doc["d"][0][1]);
+    EXPECT_EQ_FALSE(doc["e"].is_null());
+    EXPECT_EQ_FALSE(doc["e"].is_object());
+    EXPECT_EQ_INT(0, doc["e"].size());
+    EXPECT_EQ_INT(0, doc["d"].size());
+    /* the view points into the tree */
+    EXPECT_EQ_TRUE(doc["a"][1].string().data() == lept_get_string(doc["a"][1].get()));
+
+    lept::Document bad("[1");
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, bad.error());
+    EXPECT_EQ_TRUE(bad.is_null());
+    EXPECT_EQ_INT(LEPT_PARSE_OK, bad.parse(std::string("[2]")));
+    EXPECT_EQ_INT(2, bad[0].int64());
+}
+
+static void test_iterate() {
+    static const lept_parse_options packed = { LEPT_PARSE_PACK_NUMBERS, NULL, 0, 0, NULL, NULL,
+                                               0, 0, 0 };
+    lept::Document doc("{\"k1\":1,\"k2\":[1,2,3],\"k3\":{}}");
+    lept::Document numbers("[1,2,3,4]", &packed);
+    std::string keys;
+    int64_t sum = 0;
+    size_t n;
+    for (auto [key, value] : doc.members()) {
+        keys += key;
+        if (value.is_number())
+            sum += value.int64();
+    }
+    EXPECT_EQ_VIEW("k1k2k3", keys);
+    for (lept::Ref e : doc["k2"].elements())
+        sum += e.int64();
+    EXPECT_EQ_INT(7, sum);
+    for (auto m : doc["k3"].members())
+        EXPECT_EQ_TRUE(m.value.is_null());
+    EXPECT_EQ_TRUE(doc["k3"].members().begin() == doc["k3"].members().end());
+    /* nothing to walk in anything else, nor in a false Ref */
+    EXPECT_EQ_TRUE(doc.elements().begin() == doc.elements().end());
+    EXPECT_EQ_TRUE(doc["k1"].elements().begin() == doc["k1"].elements().end());
+    EXPECT_EQ_TRUE(doc["k2"].members().begin() == doc["k2"].members().end());
+    EXPECT_EQ_TRUE(doc["k4"].elements().begin() == doc["k4"].elements().end());
+    EXPECT_EQ_TRUE(doc["k4"].members().begin() == doc["k4"].members().end());
+
+    /* a packed array is walked as it is, and has no element to refer to */
+    sum = 0;
+    for (lept::Ref e : numbers.elements())
+        sum += e.int64();
+    EXPECT_EQ_INT(10, sum);
+    EXPECT_EQ_TRUE(lept_get_array_int64s(numbers.get(), &n) != nullptr);
+    EXPECT_EQ_TRUE(!numbers[0]);
+}
+
+static void test_ownership() {
+    lept::Document doc("{\"a\":[\"x\",\"y\"]}");
+    lept::Document moved(std::move(doc));
+    lept::Value copy = moved.copy(), s("abc"), n(42), b(true);
+    lept_value raw;
+    EXPECT_EQ_TRUE(doc.is_null());
+    EXPECT_EQ_VIEW("y", moved["a"][1].string());
+    EXPECT_EQ_TRUE(copy == moved);
+    EXPECT_EQ_VIEW("{\"a\":[\"x\",\"y\"]}", copy.stringify());
+
+    copy = std::move(s);
+    EXPECT_EQ_VIEW("abc", copy.string());
+    EXPECT_EQ_TRUE(s.is_null());
+    EXPECT_EQ_INT(42, n.int64());
+    EXPECT_EQ_TRUE(b.boolean());
+    EXPECT_EQ_TRUE(copy != n);
+
+    raw = moved.release();
+    EXPECT_EQ_TRUE(moved.is_null());
+    lept::Value adopted(&raw);
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&raw));
+    EXPECT_EQ_VIEW("x", adopted["a"][0].string());
+}
+
+int main() {
+    test_access();
+    test_iterate();
+    test_ownership();
+    printf("%d/%d (%3.2f%%) passed\n",
+           test_pass, test_count, test_pass * 100.0 / test_count);
+    return main_ret;
+}